@@ -1,20 +1,78 @@
+#include "vrEmuTms9918Pool.h"
 #include "vrEmuTms9918Util.h"
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
+namespace py = pybind11;
+
+// output formats by name: "rgb", "rgba" (bytes R, G, B, A) or "index"
+static vrEmuTms9918PixelFormat pixelFormat(const std::string &format) {
+  if (format == "rgb")
+    return TMS_PIXEL_FORMAT_RGB24;
+  if (format == "rgba")
+    return TMS_PIXEL_FORMAT_RGBA32;
+  if (format == "index")
+    return TMS_PIXEL_FORMAT_INDEX;
+  throw py::value_error("format must be 'rgb', 'rgba' or 'index'");
+}
+
+// size of a VRAM image: 16KB VRAM followed by the 8 registers
+#define TMS9918_IMAGE_VRAM_BYTES (16 * 1024)
+#define TMS9918_IMAGE_BYTES (TMS9918_IMAGE_VRAM_BYTES + TMS_NUM_REGISTERS)
+
+// throw unless the buffer is C-contiguous bytes (uint8, int8 or char
+// items). returns its size in bytes
+static size_t contiguousBytes(const py::buffer_info &info) {
+  if (info.itemsize != 1 ||
+      (info.format != "B" && info.format != "b" && info.format != "c"))
+    throw py::value_error("buffer must hold bytes (uint8, int8 or char items)");
+
+  py::ssize_t expectedStride = info.itemsize;
+  for (py::ssize_t i = info.ndim - 1; i >= 0; --i) {
+    if (info.strides[i] != expectedStride)
+      throw py::value_error("buffer must be C-contiguous");
+    expectedStride *= info.shape[i];
+  }
+  return (size_t)(info.size * info.itemsize);
+}
+
+// load an image: registers, then VRAM from address 0.
+// also used as the render pool's per-job prepare step
+static void loadImageBytes(VrEmuTms9918 *tms, const void *image) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(image);
+  for (int i = 0; i < TMS_NUM_REGISTERS; ++i) {
+    vrEmuTms9918WriteRegValue(tms, vrEmuTms9918Register(i),
+                              bytes[TMS9918_IMAGE_VRAM_BYTES + i]);
+  }
+  vrEmuTms9918SetAddressWrite(tms, 0);
+  vrEmuTms9918WriteBytes(tms, bytes, TMS9918_IMAGE_VRAM_BYTES);
+}
+
 class Tms9918 {
 public:
   Tms9918();
   ~Tms9918();
   void setReg(uint8_t reg, uint8_t val);
   void setRegs(const std::vector<uint8_t> &val);
+  void setRegsBuffer(py::buffer val);
   void setVram(uint16_t addr, const std::vector<uint8_t> &data);
-  std::vector<uint8_t> getScreen();
+  void setVramBuffer(uint16_t addr, py::buffer data);
+  void loadImage(py::object source, bool useMmap);
+  py::array_t<uint8_t> getScreen(const std::string &format);
+  void renderInto(py::buffer buffer, const std::string &format);
 
 private:
+  void loadImageBuffer(py::buffer image);
+
   VrEmuTms9918 *t;
 };
 
@@ -37,38 +95,218 @@ void Tms9918::setVram(uint16_t addr, const std::vector<uint8_t> &data) {
   vrEmuTms9918WriteBytes(t, data.data(), data.size());
 }
 
-std::vector<uint8_t> Tms9918::getScreen() {
-  uint8_t scanline[TMS9918_PIXELS_X]; // scanline buffer
+// bytes, bytearray, memoryview, numpy arrays... (no copy)
+void Tms9918::setRegsBuffer(py::buffer val) {
+  py::buffer_info info = val.request();
+  const size_t size = contiguousBytes(info);
+  const uint8_t *regs = static_cast<const uint8_t *>(info.ptr);
+
+  for (size_t i = 0; i < size && i < TMS_NUM_REGISTERS; ++i) {
+    vrEmuTms9918WriteRegValue(t, vrEmuTms9918Register(i), regs[i]);
+  }
+}
+
+// bytes, bytearray, memoryview, numpy arrays... (no copy)
+void Tms9918::setVramBuffer(uint16_t addr, py::buffer data) {
+  py::buffer_info info = data.request();
+  const size_t size = contiguousBytes(info);
+
+  vrEmuTms9918SetAddressWrite(t, addr);
+  vrEmuTms9918WriteBytes(t, static_cast<const uint8_t *>(info.ptr), size);
+}
+
+void Tms9918::loadImageBuffer(py::buffer image) {
+  py::buffer_info info = image.request();
+  if (contiguousBytes(info) < TMS9918_IMAGE_BYTES)
+    throw py::value_error("image must be 16KB of VRAM followed by 8 registers");
 
-  // an example output (a framebuffer for an SDL texture)
-  std::vector<uint8_t> framebuffer(TMS9918_PIXELS_X * TMS9918_PIXELS_Y * 3);
+  loadImageBytes(t, static_cast<const uint8_t *>(info.ptr));
+}
 
-  // generate all scanlines and render to framebuffer
-  size_t c = 0;
-  for (int y = 0; y < TMS9918_PIXELS_Y; ++y) {
-    // get the scanline pixels
-    vrEmuTms9918ScanLine(t, y, scanline);
-    for (int x = 0; x < TMS9918_PIXELS_X; ++x) {
-      // values returned from vrEmuTms9918ScanLine() are palette indexes
-      // use the vrEmuTms9918Palette array to convert to an RGBA value
+// load a VRAM image (as image.bin) from a file path or a buffer.
+// files are read whole, or mapped with useMmap
+void Tms9918::loadImage(py::object source, bool useMmap) {
+  if (!py::isinstance<py::str>(source) && !py::hasattr(source, "__fspath__")) {
+    loadImageBuffer(source.cast<py::buffer>());
+    return;
+  }
 
-      uint32_t col = vrEmuTms9918Palette[scanline[x]];
-      framebuffer[c++] = (col >> 24) & 0xFF;
-      framebuffer[c++] = (col >> 16) & 0xFF;
-      framebuffer[c++] = (col >> 8) & 0xFF;
+  py::object file = py::module_::import("builtins").attr("open")(source, "rb");
+  try {
+    if (useMmap) {
+      py::module_ mmap = py::module_::import("mmap");
+      py::object mapped = mmap.attr("mmap")(file.attr("fileno")(), 0,
+                                            py::arg("access") = mmap.attr("ACCESS_READ"));
+      try {
+        loadImageBuffer(mapped.cast<py::buffer>());
+      } catch (...) {
+        mapped.attr("close")();
+        throw;
+      }
+      mapped.attr("close")();
+    } else {
+      loadImageBuffer(file.attr("read")().cast<py::buffer>());
     }
+  } catch (...) {
+    file.attr("close")();
+    throw;
   }
-  return framebuffer;
+  file.attr("close")();
 }
 
-namespace py = pybind11;
+// render to a new (192, 256, channels) array, or (192, 256) for "index"
+py::array_t<uint8_t> Tms9918::getScreen(const std::string &format) {
+  const vrEmuTms9918PixelFormat fmt = pixelFormat(format);
+  const py::ssize_t channels = vrEmuTms9918PixelFormatBytes(fmt);
+
+  std::vector<py::ssize_t> shape = {TMS9918_PIXELS_Y, TMS9918_PIXELS_X};
+  if (fmt != TMS_PIXEL_FORMAT_INDEX)
+    shape.push_back(channels);
+
+  py::array_t<uint8_t> screen(shape);
+  uint8_t *pixels = screen.mutable_data();
+
+  {
+    py::gil_scoped_release release;
+    vrEmuTms9918RenderFrameFormat(t, pixels, TMS9918_PIXELS_X * channels, fmt);
+  }
+  return screen;
+}
+
+// render into a caller-owned, writable, C-contiguous buffer of
+// 192 * 256 * channels bytes (numpy array, bytearray, memoryview...)
+void Tms9918::renderInto(py::buffer buffer, const std::string &format) {
+  const vrEmuTms9918PixelFormat fmt = pixelFormat(format);
+  const size_t pitch = TMS9918_PIXELS_X * vrEmuTms9918PixelFormatBytes(fmt);
+
+  py::buffer_info info = buffer.request(true);
+  if (contiguousBytes(info) < pitch * TMS9918_PIXELS_Y)
+    throw py::value_error("buffer is too small for a frame");
+
+  py::gil_scoped_release release;
+  vrEmuTms9918RenderFrameFormat(t, info.ptr, pitch, fmt);
+}
+
+// render pool shared by renderImages() calls. created on first use and
+// recreated when a different number of threads is asked for
+static std::mutex renderPoolLock;
+static VrEmuTms9918Pool *renderPool = nullptr;
+static unsigned renderPoolThreads = 0;
+
+static void destroyRenderPool() {
+  std::lock_guard<std::mutex> guard(renderPoolLock);
+  vrEmuTms9918PoolDestroy(renderPool);
+  renderPool = nullptr;
+}
+
+static void destroyInstances(std::vector<VrEmuTms9918 *> &instances) {
+  for (size_t i = 0; i < instances.size(); ++i)
+    vrEmuTms9918Destroy(instances[i]);
+  instances.clear();
+}
+
+// render many images (as image.bin) on native threads with the GIL released.
+// states is a sequence of images or one contiguous buffer of N images.
+// returns an (N, 192, 256, channels) array, or (N, 192, 256) for "index"
+static py::array_t<uint8_t> renderImages(py::object states,
+                                         const std::string &format,
+                                         unsigned threads) {
+  const vrEmuTms9918PixelFormat fmt = pixelFormat(format);
+  const size_t channels = vrEmuTms9918PixelFormatBytes(fmt);
+  const size_t pitch = TMS9918_PIXELS_X * channels;
+  const size_t frameBytes = pitch * TMS9918_PIXELS_Y;
+
+  // keep every source buffer alive (and unmarshalled) while rendering
+  std::vector<py::buffer_info> infos;
+  std::vector<const uint8_t *> images;
+  if (py::isinstance<py::buffer>(states)) {
+    infos.push_back(states.cast<py::buffer>().request());
+    const size_t size = contiguousBytes(infos.back());
+    if (size % TMS9918_IMAGE_BYTES)
+      throw py::value_error("buffer must hold whole images of 16KB of VRAM followed by 8 registers");
+    const uint8_t *bytes = static_cast<const uint8_t *>(infos.back().ptr);
+    for (size_t offset = 0; offset < size; offset += TMS9918_IMAGE_BYTES)
+      images.push_back(bytes + offset);
+  } else {
+    for (py::handle state : states) {
+      infos.push_back(state.cast<py::buffer>().request());
+      if (contiguousBytes(infos.back()) < TMS9918_IMAGE_BYTES)
+        throw py::value_error("image must be 16KB of VRAM followed by 8 registers");
+      images.push_back(static_cast<const uint8_t *>(infos.back().ptr));
+    }
+  }
+
+  std::vector<py::ssize_t> shape = {(py::ssize_t)images.size(),
+                                    TMS9918_PIXELS_Y, TMS9918_PIXELS_X};
+  if (fmt != TMS_PIXEL_FORMAT_INDEX)
+    shape.push_back(channels);
+
+  py::array_t<uint8_t> screens(shape);
+  uint8_t *pixels = screens.mutable_data();
+
+  {
+    py::gil_scoped_release release;
+    std::lock_guard<std::mutex> guard(renderPoolLock);
+
+    if (renderPool == nullptr || renderPoolThreads != threads) {
+      vrEmuTms9918PoolDestroy(renderPool);
+      renderPool = vrEmuTms9918PoolNew(threads);
+      renderPoolThreads = threads;
+      if (renderPool == nullptr)
+        throw std::runtime_error("unable to create render pool");
+    }
+
+    // a few instances per thread, loaded and rendered by the pool's
+    // threads for each chunk of images
+    const size_t chunk = vrEmuTms9918PoolThreads(renderPool) * 4;
+    std::vector<VrEmuTms9918 *> instances;
+    std::vector<vrEmuTms9918PoolJob> jobs(chunk);
+    for (size_t i = 0; i < chunk && i < images.size(); ++i) {
+      VrEmuTms9918 *tms = vrEmuTms9918New();
+      if (tms == nullptr) {
+        destroyInstances(instances);
+        throw std::bad_alloc();
+      }
+      instances.push_back(tms);
+    }
+
+    for (size_t first = 0; first < images.size(); first += chunk) {
+      const size_t count = std::min(chunk, images.size() - first);
+      for (size_t i = 0; i < count; ++i) {
+        jobs[i].tms9918 = instances[i];
+        jobs[i].pixels = pixels + (first + i) * frameBytes;
+        jobs[i].pitch = pitch;
+        jobs[i].format = fmt;
+        jobs[i].prepare = loadImageBytes;
+        jobs[i].context = images[first + i];
+      }
+      vrEmuTms9918PoolRenderFrames(renderPool, jobs.data(), count);
+    }
+
+    destroyInstances(instances);
+  }
+
+  return screens;
+}
 
 PYBIND11_MODULE(tms9918, m) {
   m.doc() = "Tms9918"; // optional module docstring
   py::class_<Tms9918>(m, "Tms9918")
       .def(py::init<>())
       .def("setReg", &Tms9918::setReg)
+      .def("setRegs", &Tms9918::setRegsBuffer)
       .def("setRegs", &Tms9918::setRegs)
+      .def("setVram", &Tms9918::setVramBuffer)
       .def("setVram", &Tms9918::setVram)
-      .def("getScreen", &Tms9918::getScreen);
+      .def("loadImage", &Tms9918::loadImage, py::arg("source"),
+           py::arg("mmap") = false)
+      .def("getScreen", &Tms9918::getScreen, py::arg("format") = "rgb")
+      .def("renderInto", &Tms9918::renderInto, py::arg("buffer"),
+           py::arg("format") = "rgb");
+  m.def("renderImages", &renderImages, py::arg("states"),
+        py::arg("format") = "rgb", py::arg("threads") = 0);
+
+  // stop the render pool's threads before the interpreter goes away
+  py::module_::import("atexit").attr("register")(
+      py::cpp_function(&destroyRenderPool));
 }
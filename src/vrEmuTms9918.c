@@ -15,6 +15,31 @@
 #include <math.h>
 #include <string.h>
 
+/* SIMD scanline kernels (x86 only). define VR_TMS9918_EMU_NO_SIMD to
+   disable them all or VR_TMS9918_EMU_NO_AVX2 to limit them to SSE2 */
+#if !defined(VR_TMS9918_EMU_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+  #define TMS_SIMD_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    #define TMS_TARGET_SSE2
+    #define TMS_TARGET_AVX2
+  #else
+    #define TMS_TARGET_SSE2 __attribute__((target("sse2")))
+    #define TMS_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+  #if !defined(VR_TMS9918_EMU_NO_AVX2)
+    #define TMS_SIMD_AVX2 1
+  #endif
+#endif
+
+/* always inline, so constant arguments specialize the inlined body */
+#if defined(_MSC_VER) && !defined(__clang__)
+  #define TMS_FORCE_INLINE __forceinline
+#else
+  #define TMS_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
 #define VRAM_SIZE           (1 << 14) /* 16KB */
 #define VRAM_MASK     (VRAM_SIZE - 1) /* 0x3fff */
 
@@ -40,6 +65,51 @@
 #define LAST_SPRITE_YPOS        0xD0
 #define MAX_SCANLINE_SPRITES       4
 
+#define TILE_CACHE_ENTRIES    0x1800 /* one per pattern table row (3 thirds in Graphics II) */
+
+/* one per sprite name * 8 + row (16x16 rows of name 255 reach 8 rows past the table) */
+#define SPRITE_CACHE_ENTRIES  ((256 + 1) * PATTERN_BYTES)
+
+/* sprite pattern bytes that can be read (16x16 name 255 reads its right half 24 bytes past the table) */
+#define SPRITE_PATT_BYTES     ((256 + 3) * PATTERN_BYTES)
+
+#define DIRTY_WORD_BITS           64
+#define FRAME_LINE_WORDS          (TMS9918_PIXELS_Y / DIRTY_WORD_BITS)
+
+#define CHANGE_LOG_REGISTER   0x8000 /* change log address flag for a register change */
+#define CHANGE_LOG_SPAN       0x4000 /* change log address flag for a span of vram bytes */
+#define CHANGE_LOG_MIN_ENTRIES   256
+#define CHANGE_LOG_MAX_ENTRIES 0x10000
+#define CHANGE_LOG_MIN_BYTES    4096
+#define CHANGE_LOG_MAX_BYTES 0x40000 /* old and new bytes of 8 full vram writes */
+
+#define BATCH_LANES               TMS9918_BATCH_LANES
+
+#define VRAM_PAGE_BYTES          256
+#define VRAM_PAGES               (VRAM_SIZE / VRAM_PAGE_BYTES) /* 64: one bit each in a uint64_t */
+
+/* save state blob: header then vram (raw or run-length encoded)
+ *   0: magic "TMSS"         4: version         5: flags
+ *   6: registers (8)       14: status         15: regWriteStage
+ *  16: currentAddress (le) 18: timing         19: beamLine (le)
+ *  21: beamClock (le)      23: vram */
+#define STATE_MAGIC_0            'T'
+#define STATE_MAGIC_1            'M'
+#define STATE_MAGIC_2            'S'
+#define STATE_MAGIC_3            'S'
+#define STATE_FLAG_RLE          0x01
+#define STATE_HEADER_BYTES        23
+
+/* run-length control byte: 0x00-0x7f = (n + 1) literal bytes follow,
+   0x80-0xff = the next byte repeated ((n & 0x7f) + STATE_RLE_MIN_RUN) times */
+#define STATE_RLE_RUN           0x80
+#define STATE_RLE_MIN_RUN          3
+#define STATE_RLE_MAX_RUN        (0x7f + STATE_RLE_MIN_RUN)
+#define STATE_RLE_MAX_LITERALS  0x80
+
+#define SPRITE_ROW_BITS           64
+#define SPRITE_ROW_WORDS          (TMS9918_PIXELS_X / SPRITE_ROW_BITS)
+
 #define STATUS_INT              0x80
 #define STATUS_5S               0x40
 #define STATUS_COL              0x20
@@ -54,6 +124,136 @@
 #define TMS_R1_SPRITE_16        0x02
 #define TMS_R1_SPRITE_MAG2      0x01
 
+/* pattern byte expanded to one 0x00/0xff byte per pixel (msb first) */
+#define PATT_MASK_BIT(n, b)  (((n) & (0x80 >> (b))) ? 0xff : 0x00)
+#define PATT_MASK(n)         { PATT_MASK_BIT(n, 0), PATT_MASK_BIT(n, 1), PATT_MASK_BIT(n, 2), PATT_MASK_BIT(n, 3), \
+                               PATT_MASK_BIT(n, 4), PATT_MASK_BIT(n, 5), PATT_MASK_BIT(n, 6), PATT_MASK_BIT(n, 7) }
+#define PATT_MASK4(n)        PATT_MASK(n), PATT_MASK((n) + 1), PATT_MASK((n) + 2), PATT_MASK((n) + 3)
+#define PATT_MASK16(n)       PATT_MASK4(n), PATT_MASK4((n) + 4), PATT_MASK4((n) + 8), PATT_MASK4((n) + 12)
+#define PATT_MASK64(n)       PATT_MASK16(n), PATT_MASK16((n) + 16), PATT_MASK16((n) + 32), PATT_MASK16((n) + 48)
+
+static const uint8_t tmsPatternMask[256][GRAPHICS_CHAR_WIDTH] = {
+  PATT_MASK64(0), PATT_MASK64(64), PATT_MASK64(128), PATT_MASK64(192)
+};
+
+/* magnified sprite pattern bytes: each bit doubled (bit 7 -> bits 15, 14) */
+#define MAG_BITS_BIT(n, b)   (((n) & (1 << (b))) ? (0x03 << ((b) * 2)) : 0x00)
+#define MAG_BITS(n)          (MAG_BITS_BIT(n, 0) | MAG_BITS_BIT(n, 1) | MAG_BITS_BIT(n, 2) | MAG_BITS_BIT(n, 3) | \
+                              MAG_BITS_BIT(n, 4) | MAG_BITS_BIT(n, 5) | MAG_BITS_BIT(n, 6) | MAG_BITS_BIT(n, 7))
+#define MAG_BITS4(n)         MAG_BITS(n), MAG_BITS((n) + 1), MAG_BITS((n) + 2), MAG_BITS((n) + 3)
+#define MAG_BITS16(n)        MAG_BITS4(n), MAG_BITS4((n) + 4), MAG_BITS4((n) + 8), MAG_BITS4((n) + 12)
+#define MAG_BITS64(n)        MAG_BITS16(n), MAG_BITS16((n) + 16), MAG_BITS16((n) + 32), MAG_BITS16((n) + 48)
+
+static const uint16_t tmsSpriteMagBits[256] = {
+  MAG_BITS64(0), MAG_BITS64(64), MAG_BITS64(128), MAG_BITS64(192)
+};
+
+/* default output palette (RGBA) */
+static const uint32_t tmsDefaultPalette[TMS9918_NUM_COLORS] = {
+  0x00000000, /* transparent */
+  0x000000ff, /* black */
+  0x21c942ff, /* medium green */
+  0x5edc78ff, /* light green */
+  0x5455edff, /* dark blue */
+  0x7d75fcff, /* light blue */
+  0xd3524dff, /* dark red */
+  0x43ebf6ff, /* cyan */
+  0xfd5554ff, /* medium red */
+  0xff7978ff, /* light red */
+  0xd3c153ff, /* dark yellow */
+  0xe5ce80ff, /* light yellow */
+  0x21b03cff, /* dark green */
+  0xc95bbaff, /* magenta */
+  0xccccccff, /* grey */
+  0xffffffff  /* white */
+};
+
+/* how the sprite renderers handle the COL status bit */
+typedef enum
+{
+  COLLISIONS_EAGER,         /* test each line as it's rendered */
+  COLLISIONS_DEFER,         /* record lines to test when the status is needed */
+  COLLISIONS_SKIP,          /* no status output */
+} vrEmuTms9918Collisions;
+
+/* register state decoded once for a scanline or frame */
+typedef struct
+{
+  vrEmuTms9918Mode mode;
+  bool displayEnabled;
+
+  uint16_t nameTableAddr;
+  uint16_t colorTableAddr;
+  uint16_t patternTableAddr;
+  uint16_t spriteAttrTableAddr;
+  uint16_t spritePatternTableAddr;
+
+  uint8_t spriteSize;       /* 8 or 16 */
+  bool spriteMag;           /* 2x magnification */
+  uint8_t spriteSizePx;     /* on-screen size in pixels */
+
+  vrEmuTms9918Color mainBgColor;
+  vrEmuTms9918Color mainFgColor;
+
+  bool invalidGfxII;
+
+  bool useTileCache;        /* render Graphics I/II through the tile cache */
+  bool useSpriteCache;      /* read sprite rows through the sprite pattern cache */
+  vrEmuTms9918Collisions collisions;
+} vrEmuTms9918Decoded;
+
+/* sprites selected for a scanline */
+typedef struct
+{
+  uint8_t numSprites;                          /* visible sprites to output (max 4) */
+  uint8_t spriteIdx[MAX_SCANLINE_SPRITES];     /* in sprite attribute table order */
+  uint8_t pattRow[MAX_SCANLINE_SPRITES];       /* pattern row of each sprite */
+  uint8_t statusBits;                          /* 5S / sprite index bits to set (unless 5S is already set) */
+} vrEmuTms9918SpriteLine;
+
+/* a rewind snapshot. vram is stored as reverse deltas: the pages changed
+   since the previous snapshot, as they were in the previous snapshot */
+typedef struct
+{
+  uint8_t registers[TMS_NUM_REGISTERS];
+  uint8_t status;
+  uint8_t regWriteStage;
+  uint16_t currentAddress;
+  uint16_t beamLine;
+  uint16_t beamClock;
+
+  uint64_t pages;       /* vram pages saved (one bit each) */
+  uint8_t numPages;
+  size_t firstPage;     /* first saved page in the page ring */
+} vrEmuTms9918RewindFrame;
+
+/* rewind history: rings of snapshots and of their saved vram pages */
+typedef struct
+{
+  vrEmuTms9918RewindFrame* frames;
+  size_t numFrames;
+  size_t firstFrame;
+  size_t frameCount;
+
+  uint8_t (*pages)[VRAM_PAGE_BYTES];
+  size_t numPages;
+  size_t firstPage;
+  size_t pageCount;
+
+  uint8_t vram[VRAM_SIZE];  /* vram at the latest snapshot */
+} vrEmuTms9918RewindHistory;
+
+/* a vram or register change made during a frame */
+typedef struct
+{
+  uint16_t line;      /* first scanline showing the new value */
+  uint16_t addr;      /* vram address, CHANGE_LOG_REGISTER | register or CHANGE_LOG_SPAN | vram address */
+  uint8_t oldValue;
+  uint8_t newValue;
+  uint8_t spanBytes;  /* CHANGE_LOG_SPAN: number of bytes (within one dirty word) */
+  uint32_t spanOffset;/* CHANGE_LOG_SPAN: old bytes in changeLogBytes (new bytes follow) */
+} vrEmuTms9918Change;
+
  /* PRIVATE DATA STRUCTURE
   * ---------------------- */
 struct vrEmuTMS9918_s
@@ -73,10 +273,103 @@ struct vrEmuTMS9918_s
   /* current display mode */
   vrEmuTms9918Mode mode;
 
+  /* registers decoded for the renderers (refreshed with the mode) */
+  vrEmuTms9918Decoded decoded;
+
+  /* collision (COL) tests deferred until the status is needed. lines are
+     recorded as rendered and tested against the same vram and registers:
+     sprite vram and register changes resolve them first */
+  bool lazyCollisions;
+  bool collisionsPending;
+  uint64_t collisionLines[FRAME_LINE_WORDS];
+
+  /* status register timing and beam position (clocked timing only) */
+  vrEmuTms9918Timing timing;
+  uint16_t beamLine;
+  uint16_t beamClock;
+
+  /* changes made since the start of the frame (clocked timing only), so
+     frames are rendered with each change from the right scanline */
+  vrEmuTms9918Change* changeLog;
+  size_t changeLogSize;
+  size_t changeLogCapacity;
+  uint8_t* changeLogBytes;  /* old and new bytes of CHANGE_LOG_SPAN changes */
+  size_t changeLogBytesSize;
+  size_t changeLogBytesCapacity;
+  bool changeLogMidFrame;   /* a change affects some, but not all scanlines */
+  bool changeLogOverflow;   /* too many changes. frames use the current state */
+
+  /* tile expansion kernels (best available instruction set) */
+  void (*tileKernel)(const uint8_t* pattBytes, const uint8_t* colorBytes, vrEmuTms9918Color mainBgColor, uint8_t* pixels);
+  void (*textKernel)(const uint8_t* pattBytes, vrEmuTms9918Color fgColor, vrEmuTms9918Color bgColor, uint8_t* pixels);
+  void (*batchKernel)(const uint8_t (*pattBytes)[BATCH_LANES], const uint8_t (*colorBytes)[BATCH_LANES], const uint8_t* mainBgColors, uint8_t (*pixels)[TMS9918_PIXELS_X]);
+
+  /* output palette (0xRRGGBBAA) and its conversions for each pixel format */
+  uint32_t paletteRgba[TMS9918_NUM_COLORS];
+  uint32_t paletteBgra[TMS9918_NUM_COLORS];
+  uint8_t paletteRgb24[TMS9918_NUM_COLORS][3];
+  uint8_t paletteRgba32[TMS9918_NUM_COLORS][4];
+  uint16_t paletteRgb565[TMS9918_NUM_COLORS];
+
+  /* vram bytes changed since the last vrEmuTms9918RenderFrameUpdate() (one bit each) */
+  uint64_t vramDirty[VRAM_SIZE / DIRTY_WORD_BITS];
+
+  /* the frame output by the last vrEmuTms9918RenderFrameUpdate() */
+  bool lastFrameValid;
+  const void* lastFramePixels;
+  size_t lastFramePitch;
+  vrEmuTms9918PixelFormat lastFrameFormat;
+  vrEmuTms9918Decoded lastFrameDecoded;
+  uint64_t lastFrameSpriteLines[FRAME_LINE_WORDS];
+
+  /* optional cache of decoded Graphics I/II tile rows (NULL when disabled).
+     entries are indexed by pattern table offset and valid for the tables
+     and backdrop color they were decoded with */
+  uint8_t (*tileCache)[GRAPHICS_CHAR_WIDTH];
+  uint64_t tileCacheValid[TILE_CACHE_ENTRIES / DIRTY_WORD_BITS];
+  vrEmuTms9918Mode tileCacheMode;
+  uint16_t tileCachePattAddr;
+  uint16_t tileCachePattSize;
+  uint16_t tileCacheColorAddr;
+  uint16_t tileCacheColorSize;
+  vrEmuTms9918Color tileCacheBgColor;
+
+  /* cache of sprite pattern rows, indexed by sprite name * 8 + row and
+     valid for the sprite pattern table they were read from. each row
+     holds the left and right pattern bytes (msb is the leftmost pixel),
+     and the same row with each bit doubled for magnified sprites */
+  uint16_t spriteCacheRows[SPRITE_CACHE_ENTRIES];
+  uint32_t spriteCacheMagRows[SPRITE_CACHE_ENTRIES];
+  uint64_t spriteCacheValid[(SPRITE_CACHE_ENTRIES + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS];
+  uint16_t spriteCacheAddr;
+
+  /* vram pages changed since the last rewind snapshot (one bit each) */
+  uint64_t vramPagesWritten;
+
+  /* optional rewind history (NULL when disabled) */
+  vrEmuTms9918RewindHistory* rewindHistory;
+
   /* video ram */
   uint8_t vram[VRAM_SIZE];
 };
 
+/* expand a row of 32 graphics tiles given their pattern and color bytes */
+typedef void (*vrEmuTms9918TileKernel)(const uint8_t* pattBytes, const uint8_t* colorBytes, vrEmuTms9918Color mainBgColor, uint8_t* pixels);
+
+/* expand a row of 40 text glyphs given their pattern bytes */
+typedef void (*vrEmuTms9918TextKernel)(const uint8_t* pattBytes, vrEmuTms9918Color fgColor, vrEmuTms9918Color bgColor, uint8_t* pixels);
+
+/* expand the same row of 32 graphics tiles for BATCH_LANES instances.
+   inputs are structure-of-arrays: [tile][lane] */
+typedef void (*vrEmuTms9918BatchKernel)(const uint8_t (*pattBytes)[BATCH_LANES], const uint8_t (*colorBytes)[BATCH_LANES], const uint8_t* mainBgColors, uint8_t (*pixels)[TMS9918_PIXELS_X]);
+
+
+/* scanline renderer for a single display mode */
+typedef void (*vrEmuTms9918ScanLineFn)(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X]);
+
+/* sprite renderer for a single sprite size and magnification */
+typedef void (*vrEmuTms9918SpriteFn)(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, const vrEmuTms9918SpriteLine* line, uint8_t* status, uint8_t pixels[TMS9918_PIXELS_X]);
+
 
 /* Function:  tmsMode
  * ----------------------------------------
@@ -197,465 +490,3405 @@ static inline vrEmuTms9918Color tmsMainFgColor(VrEmuTms9918* tms9918)
  * ----------------------------------------
  * foreground color
  */
-static inline vrEmuTms9918Color tmsFgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
+static inline vrEmuTms9918Color tmsFgColor(vrEmuTms9918Color mainBgColor, uint8_t colorByte)
 {
   const vrEmuTms9918Color c = (vrEmuTms9918Color)(colorByte >> 4);
-  return c == TMS_TRANSPARENT ? tmsMainBgColor(tms9918) : c;
+  return c == TMS_TRANSPARENT ? mainBgColor : c;
 }
 
 /* Function:  tmsBgColor
  * ----------------------------------------
  * background color
  */
-static inline vrEmuTms9918Color tmsBgColor(VrEmuTms9918* tms9918, uint8_t colorByte)
+static inline vrEmuTms9918Color tmsBgColor(vrEmuTms9918Color mainBgColor, uint8_t colorByte)
 {
   const vrEmuTms9918Color c = (vrEmuTms9918Color)(colorByte & 0x0f);
-  return c == TMS_TRANSPARENT ? tmsMainBgColor(tms9918) : c;
+  return c == TMS_TRANSPARENT ? mainBgColor : c;
 }
 
-
-/* Function:  vrEmuTms9918New
+/* Function:  tmsExpandPattern
  * ----------------------------------------
- * create a new TMS9918
+ * write the 8 pixels of a pattern byte in fg/bg colors
+ *
+ * the pattern mask and both colors are blended as single 64-bit words
  */
-VR_EMU_TMS9918_DLLEXPORT VrEmuTms9918* vrEmuTms9918New()
+static inline void tmsExpandPattern(uint8_t* pixels, uint8_t pattByte, uint8_t fgColor, uint8_t bgColor)
 {
-  VrEmuTms9918* tms9918 = (VrEmuTms9918*)malloc(sizeof(VrEmuTms9918));
-  if (tms9918 != NULL)
-  {
-    vrEmuTms9918Reset(tms9918);
- }
+  uint64_t mask;
+  memcpy(&mask, tmsPatternMask[pattByte], sizeof(mask));
 
-  return tms9918;
+  const uint64_t fg = fgColor * 0x0101010101010101ull;
+  const uint64_t bg = bgColor * 0x0101010101010101ull;
+  const uint64_t pix = bg ^ ((fg ^ bg) & mask);
+
+  memcpy(pixels, &pix, sizeof(pix));
 }
 
-/* Function:  vrEmuTms9918Reset
+/* Function:  tmsTileKernelScalar
  * ----------------------------------------
- * reset the new TMS9918
+ * expand a row of graphics tiles (portable)
  */
-VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918Reset(VrEmuTms9918* tms9918)
+static void tmsTileKernelScalar(const uint8_t* pattBytes, const uint8_t* colorBytes, vrEmuTms9918Color mainBgColor, uint8_t* pixels)
 {
-  if (tms9918)
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
   {
-    tms9918->currentAddress = 0;
-    tms9918->regWriteStage = 0;
-    tms9918->status = 0;
-    memset(tms9918->registers, 0, sizeof(tms9918->registers));
-
-    /* ram intentionally left in unknown state */
-
-    tms9918->mode = tmsMode(tms9918);
+    tmsExpandPattern(pixels + tileX * GRAPHICS_CHAR_WIDTH, pattBytes[tileX],
+                     tmsFgColor(mainBgColor, colorBytes[tileX]),
+                     tmsBgColor(mainBgColor, colorBytes[tileX]));
   }
 }
 
-
-/* Function:  vrEmuTms9918Destroy
+/* Function:  tmsTextKernelScalar
  * ----------------------------------------
- * destroy a TMS9918
+ * expand a row of text glyphs (portable)
  *
- * tms9918: tms9918 object to destroy / clean up
+ * each glyph is expanded to 8 pixels. the 2 extra pixels are
+ * overwritten by the next glyph (or the right padding)
  */
-VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918Destroy(VrEmuTms9918* tms9918)
+static void tmsTextKernelScalar(const uint8_t* pattBytes, vrEmuTms9918Color fgColor, vrEmuTms9918Color bgColor, uint8_t* pixels)
 {
-  if (tms9918)
+  for (uint8_t tileX = 0; tileX < TEXT_NUM_COLS; ++tileX)
   {
-    free(tms9918);
+    tmsExpandPattern(pixels + tileX * TEXT_CHAR_WIDTH, pattBytes[tileX], fgColor, bgColor);
   }
 }
 
-/* Function:  vrEmuTms9918WriteAddr
+/* Function:  tmsBatchKernelScalar
  * ----------------------------------------
- * write an address (mode = 1) to the tms9918
- *
- * data: the data (DB0 -> DB7) to send
+ * expand a row of graphics tiles for each lane (portable)
  */
-VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918WriteAddr(VrEmuTms9918* tms9918, uint8_t data)
+static void tmsBatchKernelScalar(const uint8_t (*pattBytes)[BATCH_LANES], const uint8_t (*colorBytes)[BATCH_LANES], const uint8_t* mainBgColors, uint8_t (*pixels)[TMS9918_PIXELS_X])
 {
-  if (tms9918 == NULL) return;
-
-  if (tms9918->regWriteStage == 0)
+  for (uint8_t lane = 0; lane < BATCH_LANES; ++lane)
   {
-    /* first stage byte - either an address LSB or a register value */
+    const vrEmuTms9918Color mainBgColor = (vrEmuTms9918Color)mainBgColors[lane];
 
-    tms9918->currentAddress = data;
-    tms9918->regWriteStage = 1;
+    for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    {
+      tmsExpandPattern(pixels[lane] + tileX * GRAPHICS_CHAR_WIDTH, pattBytes[tileX][lane],
+                       tmsFgColor(mainBgColor, colorBytes[tileX][lane]),
+                       tmsBgColor(mainBgColor, colorBytes[tileX][lane]));
+    }
   }
-  else
+}
+
+#if TMS_SIMD_X86
+
+/* Function:  tmsSpread8Sse2
+ * ----------------------------------------
+ * spread each of 16 bytes over 8 bytes (2 tiles per output vector)
+ */
+TMS_TARGET_SSE2 static inline void tmsSpread8Sse2(__m128i v, __m128i out[8])
+{
+  const __m128i lo = _mm_unpacklo_epi8(v, v);
+  const __m128i hi = _mm_unpackhi_epi8(v, v);
+  const __m128i q[4] = {
+    _mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+    _mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)
+  };
+
+  for (int i = 0; i < 4; ++i)
   {
-    /* second byte - either a register number or an address MSB */
+    out[i * 2] = _mm_unpacklo_epi32(q[i], q[i]);
+    out[i * 2 + 1] = _mm_unpackhi_epi32(q[i], q[i]);
+  }
+}
 
-    if (data & 0x80) /* register */
-    {
-      tms9918->registers[data & 0x07] = tms9918->currentAddress & 0xff;
+/* Function:  tmsPixelsSse2
+ * ----------------------------------------
+ * select fg where the pattern bit is set, bg otherwise
+ */
+TMS_TARGET_SSE2 static inline __m128i tmsPixelsSse2(__m128i patt, __m128i fg, __m128i bg)
+{
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m128i mask = _mm_cmpeq_epi8(_mm_and_si128(patt, bits), bits);
+  return _mm_or_si128(_mm_and_si128(mask, fg), _mm_andnot_si128(mask, bg));
+}
 
-      tms9918->mode = tmsMode(tms9918);
-    }
-    else /* address */
+/* Function:  tmsTileKernelSse2
+ * ----------------------------------------
+ * expand a row of graphics tiles (SSE2, 16 tiles per pass)
+ */
+TMS_TARGET_SSE2 static void tmsTileKernelSse2(const uint8_t* pattBytes, const uint8_t* colorBytes, vrEmuTms9918Color mainBgColor, uint8_t* pixels)
+{
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i transparent = _mm_setzero_si128();
+  const __m128i backdrop = _mm_set1_epi8((char)mainBgColor);
+
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; tileX += 16)
+  {
+    const __m128i color = _mm_loadu_si128((const __m128i*)(colorBytes + tileX));
+    __m128i fg = _mm_and_si128(_mm_srli_epi16(color, 4), nibble);
+    __m128i bg = _mm_and_si128(color, nibble);
+
+    /* transparent colors show the backdrop */
+    const __m128i fgTransparent = _mm_cmpeq_epi8(fg, transparent);
+    const __m128i bgTransparent = _mm_cmpeq_epi8(bg, transparent);
+    fg = _mm_or_si128(_mm_andnot_si128(fgTransparent, fg), _mm_and_si128(fgTransparent, backdrop));
+    bg = _mm_or_si128(_mm_andnot_si128(bgTransparent, bg), _mm_and_si128(bgTransparent, backdrop));
+
+    __m128i patt[8], fgs[8], bgs[8];
+    tmsSpread8Sse2(_mm_loadu_si128((const __m128i*)(pattBytes + tileX)), patt);
+    tmsSpread8Sse2(fg, fgs);
+    tmsSpread8Sse2(bg, bgs);
+
+    for (int i = 0; i < 8; ++i)
     {
-      tms9918->currentAddress |= ((data & 0x3f) << 8);
+      _mm_storeu_si128((__m128i*)(pixels + (tileX + i * 2) * GRAPHICS_CHAR_WIDTH), tmsPixelsSse2(patt[i], fgs[i], bgs[i]));
     }
-    tms9918->regWriteStage = 0;
   }
 }
 
-/* Function:  vrEmuTms9918ReadStatus
+/* Function:  tmsTextKernelSse2
  * ----------------------------------------
- * read from the status register
+ * expand a row of text glyphs (SSE2, 2 glyphs per pass)
  */
-VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadStatus(VrEmuTms9918* tms9918)
+TMS_TARGET_SSE2 static void tmsTextKernelSse2(const uint8_t* pattBytes, vrEmuTms9918Color fgColor, vrEmuTms9918Color bgColor, uint8_t* pixels)
 {
-  if (tms9918 == NULL) return 0;
+  const __m128i fg = _mm_set1_epi8((char)fgColor);
+  const __m128i bg = _mm_set1_epi8((char)bgColor);
 
-  const uint8_t tmpStatus = tms9918->status;
-  tms9918->status = 0;
-  tms9918->regWriteStage = 0;
-  return tmpStatus;
+  for (uint8_t tileX = 0; tileX < TEXT_NUM_COLS; tileX += 2)
+  {
+    __m128i patt = _mm_cvtsi32_si128(pattBytes[tileX] | (pattBytes[tileX + 1] << 8));
+    patt = _mm_unpacklo_epi8(patt, patt);
+    patt = _mm_unpacklo_epi16(patt, patt);
+    patt = _mm_unpacklo_epi32(patt, patt);
+
+    const __m128i pix = tmsPixelsSse2(patt, fg, bg);
+    _mm_storel_epi64((__m128i*)(pixels + tileX * TEXT_CHAR_WIDTH), pix);
+    _mm_storel_epi64((__m128i*)(pixels + (tileX + 1) * TEXT_CHAR_WIDTH), _mm_srli_si128(pix, 8));
+  }
 }
 
-
-/* Function:  vrEmuTms9918WriteData
+/* Function:  tmsBatchKernelSse2
  * ----------------------------------------
- * write data (mode = 0) to the tms9918
+ * expand a row of graphics tiles for each lane (SSE2, 16 lanes per pass)
  *
- * data: the data (DB0 -> DB7) to send
+ * colors and pixels are computed lane-parallel (one byte per lane), then
+ * the 8 pixel vectors of each tile are transposed into the lanes' rows
  */
-VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918WriteData(VrEmuTms9918* tms9918, uint8_t data)
+TMS_TARGET_SSE2 static void tmsBatchKernelSse2(const uint8_t (*pattBytes)[BATCH_LANES], const uint8_t (*colorBytes)[BATCH_LANES], const uint8_t* mainBgColors, uint8_t (*pixels)[TMS9918_PIXELS_X])
 {
-  if (tms9918 == NULL) return;
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i transparent = _mm_setzero_si128();
+  const __m128i backdrop = _mm_loadu_si128((const __m128i*)mainBgColors);
+
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+  {
+    const __m128i patt = _mm_loadu_si128((const __m128i*)pattBytes[tileX]);
+    const __m128i color = _mm_loadu_si128((const __m128i*)colorBytes[tileX]);
+    __m128i fg = _mm_and_si128(_mm_srli_epi16(color, 4), nibble);
+    __m128i bg = _mm_and_si128(color, nibble);
+
+    /* transparent colors show the backdrop */
+    const __m128i fgTransparent = _mm_cmpeq_epi8(fg, transparent);
+    const __m128i bgTransparent = _mm_cmpeq_epi8(bg, transparent);
+    fg = _mm_or_si128(_mm_andnot_si128(fgTransparent, fg), _mm_and_si128(fgTransparent, backdrop));
+    bg = _mm_or_si128(_mm_andnot_si128(bgTransparent, bg), _mm_and_si128(bgTransparent, backdrop));
+
+    const __m128i diff = _mm_xor_si128(fg, bg);
+
+    /* pixel i of the tile, for every lane. the pattern is shifted left
+       each pass so the current bit is always the sign bit */
+    __m128i pix[GRAPHICS_CHAR_WIDTH];
+    __m128i bits = patt;
+    for (int i = 0; i < GRAPHICS_CHAR_WIDTH; ++i)
+    {
+      const __m128i mask = _mm_cmplt_epi8(bits, transparent);
+      pix[i] = _mm_xor_si128(bg, _mm_and_si128(diff, mask));
+      bits = _mm_add_epi8(bits, bits);
+    }
+
+    /* transpose [pixel][lane] to [lane][pixel] */
+    const __m128i a0 = _mm_unpacklo_epi8(pix[0], pix[1]), a1 = _mm_unpackhi_epi8(pix[0], pix[1]);
+    const __m128i a2 = _mm_unpacklo_epi8(pix[2], pix[3]), a3 = _mm_unpackhi_epi8(pix[2], pix[3]);
+    const __m128i a4 = _mm_unpacklo_epi8(pix[4], pix[5]), a5 = _mm_unpackhi_epi8(pix[4], pix[5]);
+    const __m128i a6 = _mm_unpacklo_epi8(pix[6], pix[7]), a7 = _mm_unpackhi_epi8(pix[6], pix[7]);
 
-  tms9918->vram[(tms9918->currentAddress++) & VRAM_MASK] = data;
+    const __m128i b[8] = {
+      _mm_unpacklo_epi16(a0, a2), _mm_unpackhi_epi16(a0, a2),   /* lanes 0-3, 4-7: pixels 0-3 */
+      _mm_unpacklo_epi16(a1, a3), _mm_unpackhi_epi16(a1, a3),   /* lanes 8-11, 12-15 */
+      _mm_unpacklo_epi16(a4, a6), _mm_unpackhi_epi16(a4, a6),   /* lanes 0-3, 4-7: pixels 4-7 */
+      _mm_unpacklo_epi16(a5, a7), _mm_unpackhi_epi16(a5, a7),   /* lanes 8-11, 12-15 */
+    };
+
+    for (int quad = 0; quad < 4; ++quad)
+    {
+      const __m128i lo = _mm_unpacklo_epi32(b[quad], b[quad + 4]);  /* lanes 4q, 4q+1 */
+      const __m128i hi = _mm_unpackhi_epi32(b[quad], b[quad + 4]);  /* lanes 4q+2, 4q+3 */
+      uint8_t* const out = pixels[quad * 4] + tileX * GRAPHICS_CHAR_WIDTH;
+
+      _mm_storel_epi64((__m128i*)out, lo);
+      _mm_storel_epi64((__m128i*)(out + TMS9918_PIXELS_X), _mm_srli_si128(lo, 8));
+      _mm_storel_epi64((__m128i*)(out + TMS9918_PIXELS_X * 2), hi);
+      _mm_storel_epi64((__m128i*)(out + TMS9918_PIXELS_X * 3), _mm_srli_si128(hi, 8));
+    }
+  }
 }
 
+#if TMS_SIMD_AVX2
 
-/* Function:  vrEmuTms9918ReadData
+/* Function:  tmsSpread4Avx2
  * ----------------------------------------
- * read data (mode = 0) from the tms9918
+ * spread 4 bytes over 8 bytes each
  */
-VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadData(VrEmuTms9918* tms9918)
+TMS_TARGET_AVX2 static inline __m256i tmsSpread4Avx2(const uint8_t* bytes)
 {
-  if (tms9918 == NULL) return 0;
-
-  return tms9918->vram[(tms9918->currentAddress++) & VRAM_MASK];
+  const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                          2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  int32_t v;
+  memcpy(&v, bytes, sizeof(v));
+  return _mm256_shuffle_epi8(_mm256_set1_epi32(v), spread);
 }
 
-/* Function:  vrEmuTms9918ReadDataNoInc
+/* Function:  tmsPixelsAvx2
  * ----------------------------------------
- * read data (mode = 0) from the tms9918
+ * select fg where the pattern bit is set, bg otherwise
  */
-VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadDataNoInc(VrEmuTms9918* tms9918)
+TMS_TARGET_AVX2 static inline __m256i tmsPixelsAvx2(__m256i patt, __m256i fg, __m256i bg)
 {
-  if (tms9918 == NULL) return 0;
-
-  return tms9918->vram[tms9918->currentAddress & VRAM_MASK];
+  const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ll);
+  const __m256i mask = _mm256_cmpeq_epi8(_mm256_and_si256(patt, bits), bits);
+  return _mm256_blendv_epi8(bg, fg, mask);
 }
 
-/* Function:  vrEmuTms9918OutputSprites
+/* Function:  tmsTileKernelAvx2
  * ----------------------------------------
- * Output Sprites to a scanline
+ * expand a row of graphics tiles (AVX2, 4 tiles per pass)
  */
-static void vrEmuTms9918OutputSprites(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+TMS_TARGET_AVX2 static void tmsTileKernelAvx2(const uint8_t* pattBytes, const uint8_t* colorBytes, vrEmuTms9918Color mainBgColor, uint8_t* pixels)
 {
-  const uint8_t spriteSizePx = tmsSpriteSize(tms9918) * (tmsSpriteMag(tms9918) ? 2 : 1);
-  const uint16_t spriteAttrTableAddr = tmsSpriteAttrTableAddr(tms9918);
-  const uint16_t spritePatternAddr = tmsSpritePatternTableAddr(tms9918);
-
-  uint8_t rowSpriteBits[TMS9918_PIXELS_X]; /* collision mask */
-  uint8_t spritesShown = 0;
-
-  if (y == 0)
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i transparent = _mm256_setzero_si256();
+  const __m256i backdrop = _mm256_set1_epi8((char)mainBgColor);
+
+  /* resolve all 32 fg/bg colors at once. transparent colors show the backdrop */
+  const __m256i color = _mm256_loadu_si256((const __m256i*)colorBytes);
+  __m256i fg = _mm256_and_si256(_mm256_srli_epi16(color, 4), nibble);
+  __m256i bg = _mm256_and_si256(color, nibble);
+  fg = _mm256_blendv_epi8(fg, backdrop, _mm256_cmpeq_epi8(fg, transparent));
+  bg = _mm256_blendv_epi8(bg, backdrop, _mm256_cmpeq_epi8(bg, transparent));
+
+  uint8_t fgBytes[GRAPHICS_NUM_COLS], bgBytes[GRAPHICS_NUM_COLS];
+  _mm256_storeu_si256((__m256i*)fgBytes, fg);
+  _mm256_storeu_si256((__m256i*)bgBytes, bg);
+
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; tileX += 4)
   {
-    tms9918->status = 0;
+    const __m256i pix = tmsPixelsAvx2(tmsSpread4Avx2(pattBytes + tileX),
+                                      tmsSpread4Avx2(fgBytes + tileX),
+                                      tmsSpread4Avx2(bgBytes + tileX));
+    _mm256_storeu_si256((__m256i*)(pixels + tileX * GRAPHICS_CHAR_WIDTH), pix);
   }
+}
 
-  for (uint8_t spriteIdx = 0; spriteIdx < MAX_SPRITES; ++spriteIdx)
+/* Function:  tmsTextKernelAvx2
+ * ----------------------------------------
+ * expand a row of text glyphs (AVX2, 4 glyphs per pass)
+ *
+ * glyphs are expanded to 8 pixels, then packed to 6. each 128-bit half
+ * holds 2 glyphs (12 pixels) and is stored as 16 bytes. the 4 extra
+ * bytes are overwritten by the next store (or the right padding)
+ */
+TMS_TARGET_AVX2 static void tmsTextKernelAvx2(const uint8_t* pattBytes, vrEmuTms9918Color fgColor, vrEmuTms9918Color bgColor, uint8_t* pixels)
+{
+  const __m256i fg = _mm256_set1_epi8((char)fgColor);
+  const __m256i bg = _mm256_set1_epi8((char)bgColor);
+  const __m256i pack = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1,
+                                        0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+
+  for (uint8_t tileX = 0; tileX < TEXT_NUM_COLS; tileX += 4)
   {
-    const uint16_t spriteAttrAddr = spriteAttrTableAddr + spriteIdx * SPRITE_ATTR_BYTES;
-    const uint8_t *spriteAttr = tms9918->vram + spriteAttrAddr;
+    const __m256i pix = _mm256_shuffle_epi8(tmsPixelsAvx2(tmsSpread4Avx2(pattBytes + tileX), fg, bg), pack);
+    uint8_t* out = pixels + tileX * TEXT_CHAR_WIDTH;
 
-    int16_t yPos = spriteAttr[SPRITE_ATTR_Y];
+    _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(pix));
+    _mm_storeu_si128((__m128i*)(out + TEXT_CHAR_WIDTH * 2), _mm256_extracti128_si256(pix, 1));
+  }
+}
 
-    /* stop processing when yPos == LAST_SPRITE_YPOS */
-    if (yPos == LAST_SPRITE_YPOS)
-    {
-      if ((tms9918->status & STATUS_5S) == 0)
-      {
-        tms9918->status |= spriteIdx;
-      }
-      break;
-    }
+/* Function:  tmsBatchKernelAvx2
+ * ----------------------------------------
+ * expand a row of graphics tiles for each lane (AVX2, 16 lanes x 2 tiles per pass)
+ *
+ * as tmsBatchKernelSse2(), with the second tile in the upper 128 bits.
+ * the transpose stays within 128-bit halves, so each lane ends up with
+ * its two tiles in separate halves and is put back together by a permute
+ */
+TMS_TARGET_AVX2 static void tmsBatchKernelAvx2(const uint8_t (*pattBytes)[BATCH_LANES], const uint8_t (*colorBytes)[BATCH_LANES], const uint8_t* mainBgColors, uint8_t (*pixels)[TMS9918_PIXELS_X])
+{
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i transparent = _mm256_setzero_si256();
+  const __m256i backdrop = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)mainBgColors));
 
-    /* check if sprite position is in the -31 to 0 range and move back to top */
-    if (yPos > (uint8_t)-32)
-    {
-      yPos -= 256;
-    }
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; tileX += 2)
+  {
+    const __m256i patt = _mm256_loadu_si256((const __m256i*)pattBytes[tileX]);
+    const __m256i color = _mm256_loadu_si256((const __m256i*)colorBytes[tileX]);
+    __m256i fg = _mm256_and_si256(_mm256_srli_epi16(color, 4), nibble);
+    __m256i bg = _mm256_and_si256(color, nibble);
+
+    /* transparent colors show the backdrop */
+    fg = _mm256_blendv_epi8(fg, backdrop, _mm256_cmpeq_epi8(fg, transparent));
+    bg = _mm256_blendv_epi8(bg, backdrop, _mm256_cmpeq_epi8(bg, transparent));
 
-    /* first row is YPOS -1 (0xff). 2nd row is YPOS 0 */
-    yPos += 1;
+    const __m256i diff = _mm256_xor_si256(fg, bg);
 
-    int16_t pattRow = y - yPos;
-    if (tmsSpriteMag(tms9918))
+    __m256i pix[GRAPHICS_CHAR_WIDTH];
+    __m256i bits = patt;
+    for (int i = 0; i < GRAPHICS_CHAR_WIDTH; ++i)
     {
-      pattRow /= 2;
+      const __m256i mask = _mm256_cmpgt_epi8(transparent, bits);
+      pix[i] = _mm256_xor_si256(bg, _mm256_and_si256(diff, mask));
+      bits = _mm256_add_epi8(bits, bits);
     }
 
-    /* check if sprite is visible on this line */
-    if (pattRow < 0 || pattRow >= tmsSpriteSize(tms9918))
-      continue;
-
-    vrEmuTms9918Color spriteColor = spriteAttr[SPRITE_ATTR_COLOR] & 0x0f;
+    /* transpose [pixel][lane] to [lane][pixel] (per 128-bit half) */
+    const __m256i a0 = _mm256_unpacklo_epi8(pix[0], pix[1]), a1 = _mm256_unpackhi_epi8(pix[0], pix[1]);
+    const __m256i a2 = _mm256_unpacklo_epi8(pix[2], pix[3]), a3 = _mm256_unpackhi_epi8(pix[2], pix[3]);
+    const __m256i a4 = _mm256_unpacklo_epi8(pix[4], pix[5]), a5 = _mm256_unpackhi_epi8(pix[4], pix[5]);
+    const __m256i a6 = _mm256_unpacklo_epi8(pix[6], pix[7]), a7 = _mm256_unpackhi_epi8(pix[6], pix[7]);
 
-    if (spritesShown == 0 && (tms9918->status & STATUS_COL) == 0)
-    {
-      /* if we're showing the first sprite, clear the bit buffer */
-      memset(rowSpriteBits, 0, TMS9918_PIXELS_X);
-    }
+    const __m256i b[8] = {
+      _mm256_unpacklo_epi16(a0, a2), _mm256_unpackhi_epi16(a0, a2),
+      _mm256_unpacklo_epi16(a1, a3), _mm256_unpackhi_epi16(a1, a3),
+      _mm256_unpacklo_epi16(a4, a6), _mm256_unpackhi_epi16(a4, a6),
+      _mm256_unpacklo_epi16(a5, a7), _mm256_unpackhi_epi16(a5, a7),
+    };
 
-    /* have we exceeded the scanline sprite limit? */
-    if (++spritesShown > MAX_SCANLINE_SPRITES)
+    for (int quad = 0; quad < 4; ++quad)
     {
-      if ((tms9918->status & STATUS_5S) == 0)
-      {
-        tms9918->status |= STATUS_5S | spriteIdx;
-      }
-      break;
+      /* qwords: lane 4q tile 0, lane 4q+1 tile 0, lane 4q tile 1, lane 4q+1 tile 1 */
+      const __m256i lo = _mm256_permute4x64_epi64(_mm256_unpacklo_epi32(b[quad], b[quad + 4]), 0xd8);
+      const __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi32(b[quad], b[quad + 4]), 0xd8);
+      uint8_t* const out = pixels[quad * 4] + tileX * GRAPHICS_CHAR_WIDTH;
+
+      _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(lo));
+      _mm_storeu_si128((__m128i*)(out + TMS9918_PIXELS_X), _mm256_extracti128_si256(lo, 1));
+      _mm_storeu_si128((__m128i*)(out + TMS9918_PIXELS_X * 2), _mm256_castsi256_si128(hi));
+      _mm_storeu_si128((__m128i*)(out + TMS9918_PIXELS_X * 3), _mm256_extracti128_si256(hi, 1));
     }
+  }
+}
 
-    /* sprite is visible on this line */
-    const uint8_t pattIdx = spriteAttr[SPRITE_ATTR_NAME];
-    const uint16_t pattOffset = spritePatternAddr + pattIdx * PATTERN_BYTES + (uint16_t)pattRow;
-
-    const int16_t earlyClockOffset = (spriteAttr[SPRITE_ATTR_COLOR] & 0x80) ? -32 : 0;
-    const int16_t xPos = (int16_t)(spriteAttr[SPRITE_ATTR_X]) + earlyClockOffset;
+#endif /* TMS_SIMD_AVX2 */
 
-    uint8_t pattByte = tms9918->vram[pattOffset];
-    uint8_t screenBit = 0, pattBit = 0;
+/* Function:  tmsCpuHasSse2 / tmsCpuHasAvx2
+ * ----------------------------------------
+ * runtime instruction set checks
+ */
+#if defined(_MSC_VER) && !defined(__clang__)
+static bool tmsCpuHasSse2(void)
+{
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+}
 
-    for (int16_t screenX = xPos; screenX < (xPos + spriteSizePx); ++screenX, ++screenBit)
-    {
-      if (screenX >= TMS9918_PIXELS_X)
-      {
-        break;
-      }
+#if TMS_SIMD_AVX2
+static bool tmsCpuHasAvx2(void)
+{
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
 
-      if (screenX >= 0)
-      {
-        if (pattByte & (0x80 >> pattBit))
-        {
-          /* we still process transparent sprites, since
-             they're used in 5S and collision checks */
-          if (spriteColor != TMS_TRANSPARENT)
-          {
-            pixels[screenX] = spriteColor;
-          }
-
-          if (rowSpriteBits[screenX])
-          {
-            tms9918->status |= STATUS_COL;
-          }
-          rowSpriteBits[screenX] = 1;
-        }
-      }
+  /* AVX registers must also be enabled by the OS (OSXSAVE + XCR0) */
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 0x06) != 0x06)
+    return false;
 
-      /* next pattern bit if non-magnified or if odd screen bit */
-      if (!tmsSpriteMag(tms9918) || (screenBit & 0x01))
-      {
-        if (++pattBit == GRAPHICS_CHAR_WIDTH) /* from A -> C or B -> D of large sprite */
-        {
-          pattBit = 0;
-          pattByte = tms9918->vram[pattOffset + PATTERN_BYTES * 2];
-        }
-      }
-    }    
-  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+#endif
+#else
+static bool tmsCpuHasSse2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
 
+#if TMS_SIMD_AVX2
+static bool tmsCpuHasAvx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
 }
+#endif
+#endif
 
+#endif /* TMS_SIMD_X86 */
 
-/* Function:  vrEmuTms9918GraphicsIScanLine
+/* Function:  tmsSelectKernels
  * ----------------------------------------
- * generate a Graphics I mode scanline
+ * choose the best tile expansion kernels for this cpu
  */
-static void vrEmuTms9918GraphicsIScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+static void tmsSelectKernels(VrEmuTms9918* tms9918)
 {
-  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
-  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
-
-  /* address in name table at the start of this row */
-  const uint16_t rowNamesAddr = tmsNameTableAddr(tms9918) + tileY * GRAPHICS_NUM_COLS;
-
-  const uint8_t *patternTable = tms9918->vram + tmsPatternTableAddr(tms9918);
-  const uint8_t *colorTable = tms9918->vram + tmsColorTableAddr(tms9918);
+  tms9918->tileKernel = tmsTileKernelScalar;
+  tms9918->textKernel = tmsTextKernelScalar;
+  tms9918->batchKernel = tmsBatchKernelScalar;
 
-  /* iterate over each tile in this row */
-  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+#if TMS_SIMD_X86
+  if (tmsCpuHasSse2())
   {
-    const uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];    
-    const uint8_t pattByte = patternTable[pattIdx * PATTERN_BYTES + pattRow];
-    const uint8_t colorByte = colorTable[pattIdx / GFXI_COLOR_GROUP_SIZE];
-
-    const uint8_t fgColor = tmsFgColor(tms9918, colorByte);
-    const uint8_t bgColor = tmsBgColor(tms9918, colorByte);
-
-    /* iterate over each bit of this pattern byte */
-    for (uint8_t pattBit = 0; pattBit < GRAPHICS_CHAR_WIDTH; ++pattBit)
-    {
-      const bool pixelBit = (pattByte << pattBit) & 0x80;
-      pixels[tileX * GRAPHICS_CHAR_WIDTH + pattBit] = pixelBit ? fgColor : bgColor;
-    }
+    tms9918->tileKernel = tmsTileKernelSse2;
+    tms9918->textKernel = tmsTextKernelSse2;
+    tms9918->batchKernel = tmsBatchKernelSse2;
   }
 
-  vrEmuTms9918OutputSprites(tms9918, y, pixels);
+#if TMS_SIMD_AVX2
+  if (tmsCpuHasAvx2())
+  {
+    tms9918->tileKernel = tmsTileKernelAvx2;
+    tms9918->textKernel = tmsTextKernelAvx2;
+    tms9918->batchKernel = tmsBatchKernelAvx2;
+  }
+#endif
+#endif
 }
 
-/* Function:  vrEmuTms9918GraphicsIIScanLine
+/* Function:  tmsDecodeRegisters
  * ----------------------------------------
- * generate a Graphics II mode scanline
+ * decode the register values used by the renderers
+ *
+ * only called by tmsRefreshDecoded(). renderers read tms9918->decoded
  */
-static void vrEmuTms9918GraphicsIIScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+static void tmsDecodeRegisters(VrEmuTms9918* tms9918, vrEmuTms9918Decoded* dec)
 {
-  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
-  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+  /* zeroed so decoded states can be compared with memcmp() */
+  memset(dec, 0, sizeof(*dec));
 
-  /* address in name table at the start of this row */
-  const uint16_t rowNamesAddr = tmsNameTableAddr(tms9918) + tileY * GRAPHICS_NUM_COLS;
+  dec->mode = tms9918->mode;
+  dec->displayEnabled = vrEmuTms9918DisplayEnabled(tms9918);
+
+  dec->nameTableAddr = tmsNameTableAddr(tms9918);
+  dec->colorTableAddr = tmsColorTableAddr(tms9918);
+  dec->patternTableAddr = tmsPatternTableAddr(tms9918);
+  dec->spriteAttrTableAddr = tmsSpriteAttrTableAddr(tms9918);
+  dec->spritePatternTableAddr = tmsSpritePatternTableAddr(tms9918);
+
+  dec->spriteSize = tmsSpriteSize(tms9918);
+  dec->spriteMag = tmsSpriteMag(tms9918);
+  dec->spriteSizePx = dec->spriteSize * (dec->spriteMag ? 2 : 1);
+
+  dec->mainBgColor = tmsMainBgColor(tms9918);
+  dec->mainFgColor = tmsMainFgColor(tms9918);
 
   /* the datasheet says the lower bits of the color and pattern tables must
      be all 1's for graphics II mode. when they're not, it seems the page
      offset becomes 0 and only the lower 3 bits of pattern name is used */
-  const bool invalidGfxII = (tms9918->registers[TMS_REG_PATTERN_TABLE] & 0x03) != 0x03 ||
-                            (tms9918->registers[TMS_REG_COLOR_TABLE] & 0x7f) != 0x7f;
+  dec->invalidGfxII = (tms9918->registers[TMS_REG_PATTERN_TABLE] & 0x03) != 0x03 ||
+                      (tms9918->registers[TMS_REG_COLOR_TABLE] & 0x7f) != 0x7f;
 
-  const uint16_t pageThird = (tileY & 0x18) >> 3; /* which page? 0-2 */
-  const uint16_t pageOffset = (uint16_t)(invalidGfxII ? 0 : pageThird << 11); /* offset (0, 0x800 or 0x1000) */
+  dec->useTileCache = tms9918->tileCache != NULL;
+  dec->useSpriteCache = true;
+  dec->collisions = (tms9918->lazyCollisions && tms9918->timing == TMS_TIMING_HOST) ? COLLISIONS_DEFER : COLLISIONS_EAGER;
+}
 
-  const uint8_t *patternTable = tms9918->vram + tmsPatternTableAddr(tms9918) + pageOffset;
-  const uint8_t *colorTable = tms9918->vram + tmsColorTableAddr(tms9918) + pageOffset;
+/* Function:  tmsRefreshDecoded
+ * ----------------------------------------
+ * refresh the mode and decoded registers after a register (or render
+ * option) change
+ */
+static inline void tmsRefreshDecoded(VrEmuTms9918* tms9918)
+{
+  tms9918->mode = tmsMode(tms9918);
+  tmsDecodeRegisters(tms9918, &tms9918->decoded);
+}
 
-  /* iterate over each tile in this row */
-  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+/* Function:  tmsResolveCollisions
+ * ----------------------------------------
+ * test any deferred collision lines (defined with the sprite renderers)
+ */
+static void tmsResolveCollisions(VrEmuTms9918* tms9918);
+
+/* Function:  tmsRangesOverlap
+ * ----------------------------------------
+ * does a vram range overlap another (both wrap at the end of vram)?
+ */
+static inline bool tmsRangesOverlap(uint16_t addr, uint16_t numBytes, uint16_t otherAddr, uint16_t otherBytes)
+{
+  return ((addr - otherAddr) & VRAM_MASK) < otherBytes ||
+         ((otherAddr - addr) & VRAM_MASK) < numBytes;
+}
+
+/* Function:  tmsSpriteVram
+ * ----------------------------------------
+ * are any of a range of vram bytes in the sprite attribute or pattern tables?
+ */
+static inline bool tmsSpriteVram(VrEmuTms9918* tms9918, uint16_t addr, uint16_t numBytes)
+{
+  /* 16x16 sprite rows are read up to 3 pattern entries past the last name
+     (unmasked, wrapping around vram) */
+  return tmsRangesOverlap(addr, numBytes, tms9918->decoded.spriteAttrTableAddr, MAX_SPRITES * SPRITE_ATTR_BYTES) ||
+         tmsRangesOverlap(addr, numBytes, tms9918->decoded.spritePatternTableAddr, SPRITE_PATT_BYTES);
+}
+
+
+/* Function:  tmsClearChangeLog
+ * ----------------------------------------
+ * start a new frame's change log
+ */
+static inline void tmsClearChangeLog(VrEmuTms9918* tms9918)
+{
+  tms9918->changeLogSize = 0;
+  tms9918->changeLogBytesSize = 0;
+  tms9918->changeLogMidFrame = false;
+  tms9918->changeLogOverflow = false;
+}
+
+/* Function:  tmsLogEntry
+ * ----------------------------------------
+ * add an entry for a change made at the current beam position
+ *
+ * returns NULL (and stops logging for the frame) when the log is full
+ */
+static vrEmuTms9918Change* tmsLogEntry(VrEmuTms9918* tms9918, uint16_t addr)
+{
+  if (tms9918->changeLogOverflow)
+    return NULL;
+
+  if (tms9918->changeLogSize == tms9918->changeLogCapacity)
   {
-    uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];
+    const size_t capacity = tms9918->changeLogCapacity ? tms9918->changeLogCapacity * 2 : CHANGE_LOG_MIN_ENTRIES;
+    vrEmuTms9918Change* changeLog = (capacity <= CHANGE_LOG_MAX_ENTRIES) ? (vrEmuTms9918Change*)realloc(tms9918->changeLog, capacity * sizeof(vrEmuTms9918Change)) : NULL;
 
-    if (invalidGfxII)
+    if (changeLog == NULL)
     {
-      pattIdx &= 0x07;
+      tms9918->changeLogOverflow = true;
+      return NULL;
     }
+    tms9918->changeLog = changeLog;
+    tms9918->changeLogCapacity = capacity;
+  }
+
+  /* a change part way through a line shows from the next line */
+  const uint16_t line = tms9918->beamLine + (tms9918->beamClock ? 1 : 0);
+
+  vrEmuTms9918Change* change = &tms9918->changeLog[tms9918->changeLogSize++];
+  change->line = line;
+  change->addr = addr;
+
+  if (line > 0 && line < TMS9918_PIXELS_Y)
+  {
+    tms9918->changeLogMidFrame = true;
+  }
+
+  return change;
+}
+
+/* Function:  tmsLogChange
+ * ----------------------------------------
+ * record a change made at the current beam position
+ */
+static void tmsLogChange(VrEmuTms9918* tms9918, uint16_t addr, uint8_t oldValue, uint8_t newValue)
+{
+  vrEmuTms9918Change* change = tmsLogEntry(tms9918, addr);
+  if (change)
+  {
+    change->oldValue = oldValue;
+    change->newValue = newValue;
+  }
+}
 
-    const size_t pattRowOffset = pattIdx * PATTERN_BYTES + pattRow;
-    const uint8_t pattByte = patternTable[pattRowOffset];
-    const uint8_t colorByte = colorTable[pattRowOffset];
+/* Function:  tmsLogSpan
+ * ----------------------------------------
+ * record a span of vram bytes (before they're written) made at the
+ * current beam position
+ */
+static void tmsLogSpan(VrEmuTms9918* tms9918, uint16_t addr, const uint8_t* bytes, uint8_t numBytes)
+{
+  if (tms9918->changeLogOverflow)
+    return;
 
-    const vrEmuTms9918Color fgColor = tmsFgColor(tms9918, colorByte);
-    const vrEmuTms9918Color bgColor = tmsBgColor(tms9918, colorByte);
+  const size_t spanSize = (size_t)numBytes * 2;
+  if (tms9918->changeLogBytesSize + spanSize > tms9918->changeLogBytesCapacity)
+  {
+    size_t capacity = tms9918->changeLogBytesCapacity ? tms9918->changeLogBytesCapacity : CHANGE_LOG_MIN_BYTES;
+    while (capacity < tms9918->changeLogBytesSize + spanSize)
+    {
+      capacity *= 2;
+    }
+    uint8_t* changeLogBytes = (capacity <= CHANGE_LOG_MAX_BYTES) ? (uint8_t*)realloc(tms9918->changeLogBytes, capacity) : NULL;
 
-    /* iterate over each bit of this pattern byte */
-    for (uint8_t pattBit = 0; pattBit < GRAPHICS_CHAR_WIDTH; ++pattBit)
+    if (changeLogBytes == NULL)
     {
-      const bool pixelBit = (pattByte << pattBit) & 0x80;
-      pixels[tileX * GRAPHICS_CHAR_WIDTH + pattBit] = (uint8_t)(pixelBit ? fgColor : bgColor);
+      tms9918->changeLogOverflow = true;
+      return;
     }
+    tms9918->changeLogBytes = changeLogBytes;
+    tms9918->changeLogBytesCapacity = capacity;
   }
 
-  vrEmuTms9918OutputSprites(tms9918, y, pixels);
+  vrEmuTms9918Change* change = tmsLogEntry(tms9918, CHANGE_LOG_SPAN | addr);
+  if (change)
+  {
+    uint8_t* spanBytes = tms9918->changeLogBytes + tms9918->changeLogBytesSize;
+    memcpy(spanBytes, tms9918->vram + addr, numBytes);
+    memcpy(spanBytes + numBytes, bytes, numBytes);
+
+    change->spanBytes = numBytes;
+    change->spanOffset = (uint32_t)tms9918->changeLogBytesSize;
+    tms9918->changeLogBytesSize += spanSize;
+  }
 }
 
-/* Function:  vrEmuTms9918TextScanLine
+/* Function:  tmsClearBits
  * ----------------------------------------
- * generate a Text mode scanline
+ * clear bits first to last - 1 of a bit array
  */
-static void vrEmuTms9918TextScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+static void tmsClearBits(uint64_t* words, size_t first, size_t last)
 {
-  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
-  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+  for (size_t bit = first; bit < last; )
+  {
+    const size_t shift = bit % DIRTY_WORD_BITS;
+    const size_t count = (last - bit < DIRTY_WORD_BITS - shift) ? last - bit : DIRTY_WORD_BITS - shift;
+    const uint64_t mask = (count == DIRTY_WORD_BITS) ? ~0ull : ((1ull << count) - 1) << shift;
 
-  /* address in name table at the start of this row */
-  const uint16_t rowNamesAddr = tmsNameTableAddr(tms9918) + tileY * TEXT_NUM_COLS;
-  const uint8_t *patternTable = tms9918->vram + tmsPatternTableAddr(tms9918);
+    words[bit / DIRTY_WORD_BITS] &= ~mask;
+    bit += count;
+  }
+}
 
-  const vrEmuTms9918Color bgColor = tmsMainBgColor(tms9918);
-  const vrEmuTms9918Color fgColor = tmsMainFgColor(tms9918);
-  
-  /* fill the first and last 8 pixels with bg color */
-  memset(pixels, bgColor, TEXT_PADDING_PX);
-  memset(pixels + TMS9918_PIXELS_X - TEXT_PADDING_PX, bgColor, TEXT_PADDING_PX);
-  
-  for (uint8_t tileX = 0; tileX < TEXT_NUM_COLS; ++tileX)
+/* Function:  tmsVramChanged
+ * ----------------------------------------
+ * record a change to a vram byte
+ */
+static inline void tmsVramChanged(VrEmuTms9918* tms9918, uint16_t addr)
+{
+  tms9918->vramDirty[addr / DIRTY_WORD_BITS] |= 1ull << (addr % DIRTY_WORD_BITS);
+  tms9918->vramPagesWritten |= 1ull << (addr / VRAM_PAGE_BYTES);
+
+  if (tms9918->tileCache)
   {
-    const uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];
-    const uint8_t pattByte = patternTable[pattIdx * PATTERN_BYTES + pattRow];
+    const uint16_t pattOffset = (uint16_t)(addr - tms9918->tileCachePattAddr);
+    const uint16_t colorOffset = (uint16_t)(addr - tms9918->tileCacheColorAddr);
+
+    if (pattOffset < tms9918->tileCachePattSize)
+    {
+      tms9918->tileCacheValid[pattOffset / DIRTY_WORD_BITS] &= ~(1ull << (pattOffset % DIRTY_WORD_BITS));
+    }
+
+    if (colorOffset < tms9918->tileCacheColorSize)
+    {
+      if (tms9918->tileCacheMode == TMS_MODE_GRAPHICS_II)
+      {
+        tms9918->tileCacheValid[colorOffset / DIRTY_WORD_BITS] &= ~(1ull << (colorOffset % DIRTY_WORD_BITS));
+      }
+      else
+      {
+        /* graphics I color byte covers 8 patterns (64 rows) */
+        tms9918->tileCacheValid[colorOffset] = 0;
+      }
+    }
+  }
 
-    for (uint8_t pattBit = 0; pattBit < TEXT_CHAR_WIDTH; ++pattBit)
+  /* a row holds its pattern byte and the byte 16 after it (right half of 16x16 sprites) */
+  const uint16_t spriteOffset = (addr - tms9918->spriteCacheAddr) & VRAM_MASK;
+  if (spriteOffset < SPRITE_PATT_BYTES)
+  {
+    if (spriteOffset < SPRITE_CACHE_ENTRIES)
+    {
+      tms9918->spriteCacheValid[spriteOffset / DIRTY_WORD_BITS] &= ~(1ull << (spriteOffset % DIRTY_WORD_BITS));
+    }
+    if (spriteOffset >= PATTERN_BYTES * 2)
     {
-      bool pixelBit = (pattByte << pattBit) & 0x80;
-      pixels[TEXT_PADDING_PX + tileX * TEXT_CHAR_WIDTH + pattBit] = (uint8_t)(pixelBit ? fgColor : bgColor);
+      const uint16_t leftOffset = spriteOffset - PATTERN_BYTES * 2;
+      tms9918->spriteCacheValid[leftOffset / DIRTY_WORD_BITS] &= ~(1ull << (leftOffset % DIRTY_WORD_BITS));
     }
   }
 }
 
-/* Function:  vrEmuTms9918MulticolorScanLine
+/* Function:  tmsVramSpanChanged
  * ----------------------------------------
- * generate a Multicolor mode scanline
+ * record a change to a span of vram bytes within one dirty word
+ *
+ * same result as tmsVramChanged() for each byte
  */
-static void vrEmuTms9918MulticolorScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+static void tmsVramSpanChanged(VrEmuTms9918* tms9918, uint16_t addr, uint8_t numBytes)
 {
-  const uint8_t tileY = y >> 3;
-  const uint8_t pattRow = ((y / 4) & 0x01) + (tileY & 0x03) * 2;
+  const uint32_t shift = addr % DIRTY_WORD_BITS;
+  tms9918->vramDirty[addr / DIRTY_WORD_BITS] |= ((numBytes == DIRTY_WORD_BITS) ? ~0ull : ((1ull << numBytes) - 1)) << shift;
+  tms9918->vramPagesWritten |= 1ull << (addr / VRAM_PAGE_BYTES);
 
-  const uint16_t namesAddr = tmsNameTableAddr(tms9918) + tileY * GRAPHICS_NUM_COLS;
-  const uint8_t *patternTable = tms9918->vram + tmsPatternTableAddr(tms9918);
+  if (tms9918->tileCache)
+  {
+    /* the tables don't wrap */
+    const uint16_t end = addr + numBytes;
+    const uint16_t pattEnd = tms9918->tileCachePattAddr + tms9918->tileCachePattSize;
+    const uint16_t colorEnd = tms9918->tileCacheColorAddr + tms9918->tileCacheColorSize;
 
-  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    if (addr < pattEnd && end > tms9918->tileCachePattAddr)
+    {
+      const uint16_t first = (addr > tms9918->tileCachePattAddr) ? addr : tms9918->tileCachePattAddr;
+      const uint16_t last = (end < pattEnd) ? end : pattEnd;
+      tmsClearBits(tms9918->tileCacheValid, first - tms9918->tileCachePattAddr, last - tms9918->tileCachePattAddr);
+    }
+
+    if (addr < colorEnd && end > tms9918->tileCacheColorAddr)
+    {
+      const uint16_t first = ((addr > tms9918->tileCacheColorAddr) ? addr : tms9918->tileCacheColorAddr) - tms9918->tileCacheColorAddr;
+      const uint16_t last = ((end < colorEnd) ? end : colorEnd) - tms9918->tileCacheColorAddr;
+
+      if (tms9918->tileCacheMode == TMS_MODE_GRAPHICS_II)
+      {
+        tmsClearBits(tms9918->tileCacheValid, first, last);
+      }
+      else
+      {
+        /* graphics I color byte covers 8 patterns (64 rows) */
+        memset(tms9918->tileCacheValid + first, 0, (last - first) * sizeof(uint64_t));
+      }
+    }
+  }
+
+  /* a row holds its pattern byte and the byte 16 after it (right half of 16x16 sprites).
+     the table is aligned, so the span's offsets don't wrap */
+  const uint16_t spriteOffset = (addr - tms9918->spriteCacheAddr) & VRAM_MASK;
+  if (spriteOffset < SPRITE_PATT_BYTES)
   {
-    const uint8_t pattIdx = tms9918->vram[namesAddr + tileX];
-    const uint8_t colorByte = patternTable[pattIdx * PATTERN_BYTES + pattRow];
+    const uint16_t first = (spriteOffset > PATTERN_BYTES * 2) ? spriteOffset - PATTERN_BYTES * 2 : 0;
+    const uint16_t last = (spriteOffset + numBytes < SPRITE_CACHE_ENTRIES) ? spriteOffset + numBytes : SPRITE_CACHE_ENTRIES;
+    tmsClearBits(tms9918->spriteCacheValid, first, last);
+  }
+}
+
+/* Function:  tmsSetVram
+ * ----------------------------------------
+ * write a vram byte, recording any change
+ */
+static inline void tmsSetVram(VrEmuTms9918* tms9918, uint16_t addr, uint8_t data)
+{
+  const uint8_t oldData = tms9918->vram[addr];
+
+  if (oldData != data)
+  {
+    if (tms9918->collisionsPending && tmsSpriteVram(tms9918, addr, 1))
+    {
+      tmsResolveCollisions(tms9918);
+    }
+
+    if (tms9918->timing != TMS_TIMING_HOST)
+    {
+      tmsLogChange(tms9918, addr, oldData, data);
+    }
+
+    tms9918->vram[addr] = data;
+    tmsVramChanged(tms9918, addr);
+  }
+}
+
+/* Function:  tmsSetRegister
+ * ----------------------------------------
+ * write a register, recording any change
+ */
+static inline void tmsSetRegister(VrEmuTms9918* tms9918, uint8_t reg, uint8_t value)
+{
+  reg &= 0x07;
+
+  if (tms9918->collisionsPending && tms9918->registers[reg] != value)
+  {
+    tmsResolveCollisions(tms9918);
+  }
 
-    memset(pixels + tileX * 8, tmsFgColor(tms9918, colorByte), 4);
-    memset(pixels + tileX * 8 + 4, tmsBgColor(tms9918, colorByte), 4);
+  if (tms9918->timing != TMS_TIMING_HOST && tms9918->registers[reg] != value)
+  {
+    tmsLogChange(tms9918, CHANGE_LOG_REGISTER | reg, tms9918->registers[reg], value);
   }
 
-  vrEmuTms9918OutputSprites(tms9918, y, pixels);
+  tms9918->registers[reg] = value;
+  tmsRefreshDecoded(tms9918);
 }
 
+/* Function:  tmsApplyChange
+ * ----------------------------------------
+ * set the old or new value(s) of a logged vram byte, vram span or
+ * register (without logging it again)
+ */
+static void tmsApplyChange(VrEmuTms9918* tms9918, const vrEmuTms9918Change* change, bool newValue)
+{
+  if (change->addr & CHANGE_LOG_REGISTER)
+  {
+    tms9918->registers[change->addr & 0x07] = newValue ? change->newValue : change->oldValue;
+    tmsRefreshDecoded(tms9918);
+  }
+  else if (change->addr & CHANGE_LOG_SPAN)
+  {
+    const uint16_t addr = change->addr & VRAM_MASK;
+    const uint8_t* spanBytes = tms9918->changeLogBytes + change->spanOffset;
 
-/* Function:  vrEmuTms9918ScanLine
+    memcpy(tms9918->vram + addr, newValue ? spanBytes + change->spanBytes : spanBytes, change->spanBytes);
+    tmsVramSpanChanged(tms9918, addr, change->spanBytes);
+  }
+  else
+  {
+    tms9918->vram[change->addr] = newValue ? change->newValue : change->oldValue;
+    tmsVramChanged(tms9918, change->addr);
+  }
+}
+
+/* Function:  vrEmuTms9918New
  * ----------------------------------------
- * generate a scanline
+ * create a new TMS9918
  */
-VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+VR_EMU_TMS9918_DLLEXPORT VrEmuTms9918* vrEmuTms9918New()
 {
-  if (tms9918 == NULL)
-    return;
+  VrEmuTms9918* tms9918 = (VrEmuTms9918*)malloc(sizeof(VrEmuTms9918));
+  if (tms9918 != NULL)
+  {
+    tms9918->tileCache = NULL;
+    memset(tms9918->spriteCacheValid, 0, sizeof(tms9918->spriteCacheValid));
+    tms9918->spriteCacheAddr = 0;
+    tms9918->rewindHistory = NULL;
+    tms9918->vramPagesWritten = 0;
+    tms9918->lazyCollisions = true;
+    tms9918->timing = TMS_TIMING_HOST;
+    tms9918->changeLog = NULL;
+    tms9918->changeLogCapacity = 0;
+    tms9918->changeLogBytes = NULL;
+    tms9918->changeLogBytesCapacity = 0;
+    tmsSelectKernels(tms9918);
+    vrEmuTms9918SetPalette(tms9918, NULL);
+    vrEmuTms9918Reset(tms9918);
+ }
+
+  return tms9918;
+}
 
-  if (!vrEmuTms9918DisplayEnabled(tms9918) || y >= TMS9918_PIXELS_Y)
+/* Function:  vrEmuTms9918Reset
+ * ----------------------------------------
+ * reset the new TMS9918
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918Reset(VrEmuTms9918* tms9918)
+{
+  if (tms9918)
   {
-    memset(pixels, tmsMainBgColor(tms9918), TMS9918_PIXELS_X);
-    return;
+    tms9918->currentAddress = 0;
+    tms9918->regWriteStage = 0;
+    tms9918->status = 0;
+    tms9918->collisionsPending = false;
+    memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+    memset(tms9918->registers, 0, sizeof(tms9918->registers));
+    memset(tms9918->vramDirty, 0, sizeof(tms9918->vramDirty));
+    tms9918->lastFrameValid = false;
+    tms9918->beamLine = 0;
+    tms9918->beamClock = 0;
+    tmsClearChangeLog(tms9918);
+
+    /* ram intentionally left in unknown state */
+
+    tmsRefreshDecoded(tms9918);
   }
+}
+
 
-  switch (tms9918->mode)
+/* Function:  vrEmuTms9918Destroy
+ * ----------------------------------------
+ * destroy a TMS9918
+ *
+ * tms9918: tms9918 object to destroy / clean up
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918Destroy(VrEmuTms9918* tms9918)
+{
+  if (tms9918)
   {
-    case TMS_MODE_GRAPHICS_I:
-      vrEmuTms9918GraphicsIScanLine(tms9918, y, pixels);
-      break;
+    vrEmuTms9918EnableRewind(tms9918, 0, 0);
+    free(tms9918->tileCache);
+    free(tms9918->changeLog);
+    free(tms9918->changeLogBytes);
+    free(tms9918);
+  }
+}
 
-    case TMS_MODE_GRAPHICS_II:
-      vrEmuTms9918GraphicsIIScanLine(tms9918, y, pixels);
-      break;
+/* Function:  tmsWriteAddr
+ * ----------------------------------------
+ * write an address (mode = 1) to the tms9918
+ */
+static inline void tmsWriteAddr(VrEmuTms9918* tms9918, uint8_t data)
+{
+  if (tms9918->regWriteStage == 0)
+  {
+    /* first stage byte - either an address LSB or a register value */
 
-    case TMS_MODE_TEXT:
-      vrEmuTms9918TextScanLine(tms9918, y, pixels);
-      break;
+    tms9918->currentAddress = data;
+    tms9918->regWriteStage = 1;
+  }
+  else
+  {
+    /* second byte - either a register number or an address MSB */
 
-    case TMS_MODE_MULTICOLOR:
-      vrEmuTms9918MulticolorScanLine(tms9918, y, pixels);
-      break;
+    if (data & 0x80) /* register */
+    {
+      tmsSetRegister(tms9918, data, tms9918->currentAddress & 0xff);
+    }
+    else /* address */
+    {
+      tms9918->currentAddress |= ((data & 0x3f) << 8);
+    }
+    tms9918->regWriteStage = 0;
   }
+}
 
-  if (y == TMS9918_PIXELS_Y - 1)
+/* Function:  vrEmuTms9918WriteAddr
+ * ----------------------------------------
+ * write an address (mode = 1) to the tms9918
+ *
+ * data: the data (DB0 -> DB7) to send
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918WriteAddr(VrEmuTms9918* tms9918, uint8_t data)
+{
+  if (tms9918 == NULL) return;
+
+  tmsWriteAddr(tms9918, data);
+}
+
+/* Function:  tmsReadStatus
+ * ----------------------------------------
+ * read from the status register
+ */
+static inline uint8_t tmsReadStatus(VrEmuTms9918* tms9918)
+{
+  if (tms9918->collisionsPending)
   {
-    tms9918->status |= STATUS_INT;
+    tmsResolveCollisions(tms9918);
   }
+
+  const uint8_t tmpStatus = tms9918->status;
+  tms9918->status = 0;
+  tms9918->regWriteStage = 0;
+  return tmpStatus;
+}
+
+/* Function:  vrEmuTms9918ReadStatus
+ * ----------------------------------------
+ * read from the status register
+ */
+VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadStatus(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL) return 0;
+
+  return tmsReadStatus(tms9918);
+}
+
+
+/* Function:  tmsWriteData
+ * ----------------------------------------
+ * write data (mode = 0) to the tms9918
+ */
+static inline void tmsWriteData(VrEmuTms9918* tms9918, uint8_t data)
+{
+  tmsSetVram(tms9918, (tms9918->currentAddress++) & VRAM_MASK, data);
+}
+
+/* Function:  vrEmuTms9918WriteData
+ * ----------------------------------------
+ * write data (mode = 0) to the tms9918
+ *
+ * data: the data (DB0 -> DB7) to send
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918WriteData(VrEmuTms9918* tms9918, uint8_t data)
+{
+  if (tms9918 == NULL) return;
+
+  tmsWriteData(tms9918, data);
+}
+
+
+/* Function:  tmsWriteVramSpan
+ * ----------------------------------------
+ * write bytes to vram (no wrap), recording changes
+ *
+ * bytes are copied a dirty word at a time. unchanged words are skipped
+ * with a single compare, and the changed bytes of the others are
+ * recorded together
+ */
+static void tmsWriteVramSpan(VrEmuTms9918* tms9918, uint16_t addr, const uint8_t* bytes, size_t numBytes)
+{
+  while (numBytes)
+  {
+    size_t span = DIRTY_WORD_BITS - (addr % DIRTY_WORD_BITS);
+    if (span > numBytes) span = numBytes;
+
+    if (memcmp(tms9918->vram + addr, bytes, span) != 0)
+    {
+      /* trim to the changed bytes */
+      size_t first = 0, last = span;
+      while (tms9918->vram[addr + first] == bytes[first]) ++first;
+      while (tms9918->vram[addr + last - 1] == bytes[last - 1]) --last;
+
+      const uint16_t changeAddr = (uint16_t)(addr + first);
+      const uint8_t changeBytes = (uint8_t)(last - first);
+
+      if (tms9918->collisionsPending && tmsSpriteVram(tms9918, changeAddr, changeBytes))
+      {
+        tmsResolveCollisions(tms9918);
+      }
+
+      if (tms9918->timing != TMS_TIMING_HOST)
+      {
+        tmsLogSpan(tms9918, changeAddr, bytes + first, changeBytes);
+      }
+
+      memcpy(tms9918->vram + changeAddr, bytes + first, changeBytes);
+      tmsVramSpanChanged(tms9918, changeAddr, changeBytes);
+    }
+
+    addr += (uint16_t)span;
+    bytes += span;
+    numBytes -= span;
+  }
+}
+
+/* Function:  vrEmuTms9918WriteBlock
+ * ----------------------------------------
+ * write a block of data (mode = 0) to the tms9918
+ *
+ * same result as calling vrEmuTms9918WriteData() for each byte
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918WriteBlock(VrEmuTms9918* tms9918, const uint8_t* bytes, size_t numBytes)
+{
+  if (tms9918 == NULL || bytes == NULL) return;
+
+  uint16_t addr = tms9918->currentAddress;
+  tms9918->currentAddress = (uint16_t)(addr + numBytes);
+
+  /* anything more than a full vram would be overwritten anyway */
+  if (numBytes > VRAM_SIZE)
+  {
+    addr += (uint16_t)(numBytes - VRAM_SIZE);
+    bytes += numBytes - VRAM_SIZE;
+    numBytes = VRAM_SIZE;
+  }
+
+  addr &= VRAM_MASK;
+
+  while (numBytes)
+  {
+    size_t span = VRAM_SIZE - addr;
+    if (span > numBytes) span = numBytes;
+
+    tmsWriteVramSpan(tms9918, addr, bytes, span);
+
+    addr = 0;
+    bytes += span;
+    numBytes -= span;
+  }
+}
+
+/* Function:  vrEmuTms9918ReadBlock
+ * ----------------------------------------
+ * read a block of data (mode = 0) from the tms9918
+ *
+ * same result as calling vrEmuTms9918ReadData() for each byte
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918ReadBlock(VrEmuTms9918* tms9918, uint8_t* bytes, size_t numBytes)
+{
+  if (tms9918 == NULL || bytes == NULL) return;
+
+  uint16_t addr = tms9918->currentAddress & VRAM_MASK;
+  tms9918->currentAddress = (uint16_t)(tms9918->currentAddress + numBytes);
+
+  while (numBytes)
+  {
+    size_t span = VRAM_SIZE - addr;
+    if (span > numBytes) span = numBytes;
+
+    memcpy(bytes, tms9918->vram + addr, span);
+
+    addr = 0;
+    bytes += span;
+    numBytes -= span;
+  }
+}
+
+/* Function:  tmsReadData
+ * ----------------------------------------
+ * read data (mode = 0) from the tms9918
+ */
+static inline uint8_t tmsReadData(VrEmuTms9918* tms9918)
+{
+  return tms9918->vram[(tms9918->currentAddress++) & VRAM_MASK];
+}
+
+/* Function:  vrEmuTms9918ReadData
+ * ----------------------------------------
+ * read data (mode = 0) from the tms9918
+ */
+VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadData(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL) return 0;
+
+  return tmsReadData(tms9918);
+}
+
+/* Function:  vrEmuTms9918ReadDataNoInc
+ * ----------------------------------------
+ * read data (mode = 0) from the tms9918
+ */
+VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918ReadDataNoInc(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL) return 0;
+
+  return tms9918->vram[tms9918->currentAddress & VRAM_MASK];
+}
+
+/* Function:  vrEmuTms9918PortOps
+ * ----------------------------------------
+ * execute a sequence of port operations
+ *
+ * ops: encoded operations (see TMS_PORT_OP_xxx)
+ * numOps: number of operations
+ * results: receives the value of each read operation, in order (may be NULL)
+ *
+ * returns the number of read operations performed
+ */
+VR_EMU_TMS9918_DLLEXPORT size_t vrEmuTms9918PortOps(VrEmuTms9918* tms9918, const vrEmuTms9918PortOp* ops, size_t numOps, uint8_t* results)
+{
+  if (tms9918 == NULL || ops == NULL) return 0;
+
+  size_t numResults = 0;
+
+  for (size_t i = 0; i < numOps; ++i)
+  {
+    const vrEmuTms9918PortOp op = ops[i];
+    const uint8_t data = op & TMS_PORT_OP_DATA_MASK;
+    uint8_t result;
+
+    switch (op & (TMS_PORT_OP_MODE | TMS_PORT_OP_READ))
+    {
+      case TMS_PORT_OP_WRITE_DATA:
+        tmsWriteData(tms9918, data);
+        continue;
+
+      case TMS_PORT_OP_WRITE_ADDR:
+        tmsWriteAddr(tms9918, data);
+        continue;
+
+      case TMS_PORT_OP_READ_DATA:
+        result = tmsReadData(tms9918);
+        break;
+
+      default: /* TMS_PORT_OP_READ_STATUS */
+        result = tmsReadStatus(tms9918);
+        break;
+    }
+
+    if (results)
+    {
+      results[numResults] = result;
+    }
+    ++numResults;
+  }
+
+  return numResults;
+}
+
+/* Function:  tmsSpriteYPos
+ * ----------------------------------------
+ * top scanline of a sprite given its attribute y position
+ */
+static inline int16_t tmsSpriteYPos(uint8_t yByte)
+{
+  int16_t yPos = yByte;
+
+  /* check if sprite position is in the -31 to 0 range and move back to top */
+  if (yPos > (uint8_t)-32)
+  {
+    yPos -= 256;
+  }
+
+  /* first row is YPOS -1 (0xff). 2nd row is YPOS 0 */
+  return yPos + 1;
+}
+
+/* Function:  tmsSpritePattRow
+ * ----------------------------------------
+ * pattern row of a sprite on a scanline (may be out of range)
+ *
+ * note: magnified rows round towards zero, so row 0 also shows on
+ *       the line above the sprite
+ */
+static inline int16_t tmsSpritePattRow(const vrEmuTms9918Decoded* dec, int16_t yPos, int16_t y)
+{
+  int16_t pattRow = y - yPos;
+  if (dec->spriteMag)
+  {
+    pattRow /= 2;
+  }
+  return pattRow;
+}
+
+/* Function:  tmsSelectSpriteLine
+ * ----------------------------------------
+ * select the sprites shown on a single scanline
+ */
+static void tmsSelectSpriteLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, vrEmuTms9918SpriteLine* line)
+{
+  line->numSprites = 0;
+  line->statusBits = 0;
+
+  for (uint8_t spriteIdx = 0; spriteIdx < MAX_SPRITES; ++spriteIdx)
+  {
+    const uint8_t yByte = tms9918->vram[(dec->spriteAttrTableAddr + spriteIdx * SPRITE_ATTR_BYTES + SPRITE_ATTR_Y) & VRAM_MASK];
+
+    /* stop processing when yPos == LAST_SPRITE_YPOS */
+    if (yByte == LAST_SPRITE_YPOS)
+    {
+      line->statusBits = spriteIdx;
+      break;
+    }
+
+    const int16_t pattRow = tmsSpritePattRow(dec, tmsSpriteYPos(yByte), y);
+
+    /* check if sprite is visible on this line */
+    if (pattRow < 0 || pattRow >= dec->spriteSize)
+      continue;
+
+    /* have we exceeded the scanline sprite limit? */
+    if (line->numSprites == MAX_SCANLINE_SPRITES)
+    {
+      line->statusBits = STATUS_5S | spriteIdx;
+      break;
+    }
+
+    line->spriteIdx[line->numSprites] = spriteIdx;
+    line->pattRow[line->numSprites] = (uint8_t)pattRow;
+    ++line->numSprites;
+  }
+}
+
+/* Function:  tmsSelectSpriteFrame
+ * ----------------------------------------
+ * select the sprites shown on every scanline of a frame
+ *
+ * a single pass over the sprite attribute table, giving the same
+ * result as tmsSelectSpriteLine() for each line
+ */
+static void tmsSelectSpriteFrame(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, vrEmuTms9918SpriteLine lines[TMS9918_PIXELS_Y])
+{
+  bool lineFull[TMS9918_PIXELS_Y]; /* 5th sprite found */
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    lines[y].numSprites = 0;
+    lines[y].statusBits = 0;
+    lineFull[y] = false;
+  }
+
+  uint8_t spriteIdx = 0;
+  for (; spriteIdx < MAX_SPRITES; ++spriteIdx)
+  {
+    const uint8_t yByte = tms9918->vram[(dec->spriteAttrTableAddr + spriteIdx * SPRITE_ATTR_BYTES + SPRITE_ATTR_Y) & VRAM_MASK];
+    if (yByte == LAST_SPRITE_YPOS)
+      break;
+
+    const int16_t yPos = tmsSpriteYPos(yByte);
+
+    int16_t firstLine = dec->spriteMag ? yPos - 1 : yPos;
+    int16_t lastLine = yPos + dec->spriteSizePx - 1;
+    if (firstLine < 0) firstLine = 0;
+    if (lastLine >= TMS9918_PIXELS_Y) lastLine = TMS9918_PIXELS_Y - 1;
+
+    for (int16_t y = firstLine; y <= lastLine; ++y)
+    {
+      vrEmuTms9918SpriteLine* line = &lines[y];
+      if (lineFull[y])
+        continue;
+
+      if (line->numSprites == MAX_SCANLINE_SPRITES)
+      {
+        line->statusBits = STATUS_5S | spriteIdx;
+        lineFull[y] = true;
+        continue;
+      }
+
+      line->spriteIdx[line->numSprites] = spriteIdx;
+      line->pattRow[line->numSprites] = (uint8_t)tmsSpritePattRow(dec, yPos, y);
+      ++line->numSprites;
+    }
+  }
+
+  /* lines which didn't find a 5th sprite stopped at LAST_SPRITE_YPOS */
+  if (spriteIdx < MAX_SPRITES)
+  {
+    for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+    {
+      if (!lineFull[y])
+      {
+        lines[y].statusBits = spriteIdx;
+      }
+    }
+  }
+}
+
+/* Function:  tmsSpriteCacheRow
+ * ----------------------------------------
+ * make sure a sprite pattern row is cached, reading it if it isn't
+ *
+ * rowOffset: sprite name * 8 + row
+ */
+static inline void tmsSpriteCacheRow(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint16_t rowOffset)
+{
+  if (tms9918->spriteCacheAddr != dec->spritePatternTableAddr)
+  {
+    memset(tms9918->spriteCacheValid, 0, sizeof(tms9918->spriteCacheValid));
+    tms9918->spriteCacheAddr = dec->spritePatternTableAddr;
+  }
+
+  uint64_t* valid = &tms9918->spriteCacheValid[rowOffset / DIRTY_WORD_BITS];
+  const uint64_t bit = 1ull << (rowOffset % DIRTY_WORD_BITS);
+
+  if ((*valid & bit) == 0)
+  {
+    const uint16_t pattOffset = dec->spritePatternTableAddr + rowOffset;
+    const uint8_t leftByte = tms9918->vram[pattOffset & VRAM_MASK];
+    const uint8_t rightByte = tms9918->vram[(pattOffset + PATTERN_BYTES * 2) & VRAM_MASK];
+
+    tms9918->spriteCacheRows[rowOffset] = (uint16_t)((leftByte << 8) | rightByte);
+    tms9918->spriteCacheMagRows[rowOffset] = ((uint32_t)tmsSpriteMagBits[leftByte] << 16) | tmsSpriteMagBits[rightByte];
+    *valid |= bit;
+  }
+}
+
+/* Function:  tmsSpriteRowBits
+ * ----------------------------------------
+ * a sprite's pattern row, left aligned in 32 bits (msb is the leftmost pixel)
+ *
+ * magnified rows are pre-widened, so each bit is always one pixel
+ *
+ * rowOffset: sprite name * 8 + row
+ */
+static TMS_FORCE_INLINE uint32_t tmsSpriteRowBits(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t spriteSize, bool spriteMag, uint16_t rowOffset)
+{
+  if (dec->useSpriteCache)
+  {
+    tmsSpriteCacheRow(tms9918, dec, rowOffset);
+
+    /* cached rows always include the right half */
+    if (spriteMag)
+    {
+      const uint32_t rowBits = tms9918->spriteCacheMagRows[rowOffset];
+      return (spriteSize > GRAPHICS_CHAR_WIDTH) ? rowBits : (rowBits & 0xffff0000);
+    }
+
+    const uint32_t rowBits = (uint32_t)tms9918->spriteCacheRows[rowOffset] << 16;
+    return (spriteSize > GRAPHICS_CHAR_WIDTH) ? rowBits : (rowBits & 0xff000000);
+  }
+
+  const uint16_t pattOffset = dec->spritePatternTableAddr + rowOffset;
+  const uint8_t leftByte = tms9918->vram[pattOffset & VRAM_MASK];
+  const uint8_t rightByte = (spriteSize > GRAPHICS_CHAR_WIDTH) ? tms9918->vram[(pattOffset + PATTERN_BYTES * 2) & VRAM_MASK] : 0;
+
+  if (spriteMag)
+  {
+    return ((uint32_t)tmsSpriteMagBits[leftByte] << 16) | tmsSpriteMagBits[rightByte];
+  }
+  return ((uint32_t)leftByte << 24) | ((uint32_t)rightByte << 16);
+}
+
+/* Function:  tmsSpriteRowMask
+ * ----------------------------------------
+ * a sprite's row as (at most two) words of a 256-bit scanline mask
+ * (msb is the leftmost pixel)
+ *
+ * offset: receives the bit offset of the row in the first word
+ *
+ * returns the index of the first word (-1 when it's off the left edge)
+ */
+static TMS_FORCE_INLINE int8_t tmsSpriteRowMask(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t spriteSize, bool spriteMag,
+                                                const uint8_t* spriteAttr, uint8_t pattRow, uint64_t spriteBits[2], uint8_t* offset)
+{
+  const uint16_t rowOffset = spriteAttr[SPRITE_ATTR_NAME] * PATTERN_BYTES + pattRow;
+
+  const int16_t earlyClockOffset = (spriteAttr[SPRITE_ATTR_COLOR] & 0x80) ? -32 : 0;
+  const int16_t xPos = (int16_t)(spriteAttr[SPRITE_ATTR_X]) + earlyClockOffset;
+
+  const uint64_t rowBits = (uint64_t)tmsSpriteRowBits(tms9918, dec, spriteSize, spriteMag, rowOffset) << 32;
+
+  /* split the row over (at most) two scanline mask words */
+  const int16_t shiftedX = xPos + SPRITE_ROW_BITS; /* avoid negatives: -32 -> 32 */
+  const int8_t word = (int8_t)(shiftedX / SPRITE_ROW_BITS) - 1;
+  *offset = shiftedX % SPRITE_ROW_BITS;
+
+  spriteBits[0] = (word >= 0) ? (rowBits >> *offset) : 0;
+  spriteBits[1] = (*offset && word + 1 < SPRITE_ROW_WORDS) ? (rowBits << (SPRITE_ROW_BITS - *offset)) : 0;
+
+  return word;
+}
+
+/* Function:  tmsSpriteLineCollides
+ * ----------------------------------------
+ * do any of a scanline's sprites overlap?
+ */
+static bool tmsSpriteLineCollides(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, const vrEmuTms9918SpriteLine* line)
+{
+  uint64_t rowSpriteBits[SPRITE_ROW_WORDS] = { 0 };
+
+  for (uint8_t i = 0; i < line->numSprites; ++i)
+  {
+    const uint8_t* spriteAttr = tms9918->vram + dec->spriteAttrTableAddr + line->spriteIdx[i] * SPRITE_ATTR_BYTES;
+
+    uint64_t spriteBits[2];
+    uint8_t offset;
+    const int8_t word = tmsSpriteRowMask(tms9918, dec, dec->spriteSize, dec->spriteMag, spriteAttr, line->pattRow[i], spriteBits, &offset);
+
+    for (int8_t w = 0; w < 2; ++w)
+    {
+      if (spriteBits[w])
+      {
+        if (rowSpriteBits[word + w] & spriteBits[w])
+          return true;
+        rowSpriteBits[word + w] |= spriteBits[w];
+      }
+    }
+  }
+  return false;
+}
+
+/* Function:  tmsResolveCollisions
+ * ----------------------------------------
+ * test any deferred collision lines, setting COL if one collides
+ */
+static void tmsResolveCollisions(VrEmuTms9918* tms9918)
+{
+  uint64_t lines[FRAME_LINE_WORDS];
+  memcpy(lines, tms9918->collisionLines, sizeof(lines));
+  memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+  tms9918->collisionsPending = false;
+
+  if (tms9918->status & STATUS_COL)
+    return;
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  vrEmuTms9918SpriteLine spriteLines[TMS9918_PIXELS_Y];
+  tmsSelectSpriteFrame(tms9918, &dec, spriteLines);
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    if (((lines[y / DIRTY_WORD_BITS] >> (y % DIRTY_WORD_BITS)) & 1) &&
+        tmsSpriteLineCollides(tms9918, &dec, &spriteLines[y]))
+    {
+      tms9918->status |= STATUS_COL;
+      return;
+    }
+  }
+}
+
+/* Function:  tmsOutputSprites
+ * ----------------------------------------
+ * Output Sprites to a scanline
+ *
+ * each sprite row is shifted into a 256-bit scanline mask. collisions
+ * are found by AND-ing it with the mask of the sprites already drawn
+ *
+ * only inlined into the renderers below, with a constant sprite size
+ * and magnification
+ *
+ * status: status register to update (5S, sprite index, COL). deferred
+ *         collision lines are recorded in the tms9918 instead
+ * pixels: scanline to draw on, or NULL to only update the status
+ */
+static TMS_FORCE_INLINE void tmsOutputSprites(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, const vrEmuTms9918SpriteLine* line,
+                                                uint8_t* status, uint8_t pixels[TMS9918_PIXELS_X], uint8_t spriteSize, bool spriteMag)
+{
+  const uint16_t spriteAttrTableAddr = dec->spriteAttrTableAddr;
+
+  uint64_t rowSpriteBits[SPRITE_ROW_WORDS] = { 0 }; /* collision mask (msb is leftmost pixel) */
+
+  if (dec->collisions != COLLISIONS_SKIP)
+  {
+    if (y == 0)
+    {
+      *status = 0;
+
+      if (dec->collisions == COLLISIONS_DEFER)
+      {
+        memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+      }
+    }
+
+    if ((*status & STATUS_5S) == 0)
+    {
+      *status |= line->statusBits;
+    }
+
+    if (dec->collisions == COLLISIONS_DEFER && line->numSprites > 1 && (*status & STATUS_COL) == 0)
+    {
+      tms9918->collisionLines[y / DIRTY_WORD_BITS] |= 1ull << (y % DIRTY_WORD_BITS);
+      tms9918->collisionsPending = true;
+    }
+  }
+
+  const bool testCollisions = dec->collisions == COLLISIONS_EAGER && (*status & STATUS_COL) == 0;
+
+  /* status only: nothing left to find */
+  if (pixels == NULL && !testCollisions)
+    return;
+
+  for (uint8_t i = 0; i < line->numSprites; ++i)
+  {
+    const uint16_t spriteAttrAddr = spriteAttrTableAddr + line->spriteIdx[i] * SPRITE_ATTR_BYTES;
+    const uint8_t *spriteAttr = tms9918->vram + spriteAttrAddr;
+
+    vrEmuTms9918Color spriteColor = spriteAttr[SPRITE_ATTR_COLOR] & 0x0f;
+
+    /* sprite is visible on this line. position, early clock and
+       clipping are all resolved into the mask words */
+    uint64_t spriteBits[2];
+    uint8_t offset;
+    const int8_t word = tmsSpriteRowMask(tms9918, dec, spriteSize, spriteMag, spriteAttr, line->pattRow[i], spriteBits, &offset);
+
+    for (int8_t w = 0; w < 2; ++w)
+    {
+      const uint64_t bits = spriteBits[w];
+      if (!bits)
+        continue;
+
+      const uint8_t screenWord = word + w;
+
+      /* we still process transparent sprites, since
+         they're used in 5S and collision checks */
+      if (testCollisions)
+      {
+        if (rowSpriteBits[screenWord] & bits)
+        {
+          *status |= STATUS_COL;
+        }
+        rowSpriteBits[screenWord] |= bits;
+      }
+
+      if (spriteColor == TMS_TRANSPARENT || pixels == NULL)
+        continue;
+
+      /* write pixels 8 at a time, from the first group the row covers
+         until no bits are left, skipping empty groups */
+      const uint64_t color = spriteColor * 0x0101010101010101ull;
+      const uint8_t firstGroup = (w == 0) ? offset / GRAPHICS_CHAR_WIDTH : 0;
+      uint8_t* groupPixels = pixels + screenWord * SPRITE_ROW_BITS + firstGroup * GRAPHICS_CHAR_WIDTH;
+      for (uint64_t rowBits = bits << (firstGroup * GRAPHICS_CHAR_WIDTH); rowBits; rowBits <<= GRAPHICS_CHAR_WIDTH, groupPixels += GRAPHICS_CHAR_WIDTH)
+      {
+        const uint8_t groupBits = (uint8_t)(rowBits >> (SPRITE_ROW_BITS - GRAPHICS_CHAR_WIDTH));
+        if (groupBits)
+        {
+          uint64_t mask, pix;
+          memcpy(&mask, tmsPatternMask[groupBits], sizeof(mask));
+          memcpy(&pix, groupPixels, sizeof(pix));
+          pix ^= (pix ^ color) & mask;
+          memcpy(groupPixels, &pix, sizeof(pix));
+        }
+      }
+    }
+  }
+}
+
+/* sprite renderers specialized for each sprite size and magnification */
+#define TMS_SPRITE_RENDERER(name, spriteSize, spriteMag) \
+  static void name(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, const vrEmuTms9918SpriteLine* line, uint8_t* status, uint8_t pixels[TMS9918_PIXELS_X]) \
+  { \
+    tmsOutputSprites(tms9918, dec, y, line, status, pixels, spriteSize, spriteMag); \
+  }
+
+TMS_SPRITE_RENDERER(tmsOutputSprites8, 8, false)
+TMS_SPRITE_RENDERER(tmsOutputSprites8Mag, 8, true)
+TMS_SPRITE_RENDERER(tmsOutputSprites16, 16, false)
+TMS_SPRITE_RENDERER(tmsOutputSprites16Mag, 16, true)
+
+/* Function:  tmsSpriteFn
+ * ----------------------------------------
+ * sprite renderer for the decoded sprite size and magnification
+ */
+static vrEmuTms9918SpriteFn tmsSpriteFn(const vrEmuTms9918Decoded* dec)
+{
+  if (dec->spriteSize > GRAPHICS_CHAR_WIDTH)
+  {
+    return dec->spriteMag ? tmsOutputSprites16Mag : tmsOutputSprites16;
+  }
+  return dec->spriteMag ? tmsOutputSprites8Mag : tmsOutputSprites8;
+}
+
+/* Function:  tmsOutputLineSprites
+ * ----------------------------------------
+ * select and output the sprites of a single scanline
+ */
+static void tmsOutputLineSprites(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t* status, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  if (dec->mode != TMS_MODE_TEXT)
+  {
+    vrEmuTms9918SpriteLine line;
+    tmsSelectSpriteLine(tms9918, dec, y, &line);
+    tmsSpriteFn(dec)(tms9918, dec, y, &line, status, pixels);
+  }
+}
+
+
+/* Function:  tmsTileCacheSync
+ * ----------------------------------------
+ * drop all cached tiles if the tables or backdrop color have changed
+ */
+static void tmsTileCacheSync(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec)
+{
+  const bool gfxII = dec->mode == TMS_MODE_GRAPHICS_II;
+
+  if (tms9918->tileCacheMode != dec->mode ||
+      tms9918->tileCachePattAddr != dec->patternTableAddr ||
+      tms9918->tileCacheColorAddr != dec->colorTableAddr ||
+      tms9918->tileCacheBgColor != dec->mainBgColor)
+  {
+    memset(tms9918->tileCacheValid, 0, sizeof(tms9918->tileCacheValid));
+    tms9918->tileCacheMode = dec->mode;
+    tms9918->tileCachePattAddr = dec->patternTableAddr;
+    tms9918->tileCachePattSize = gfxII ? TILE_CACHE_ENTRIES : 256 * PATTERN_BYTES;
+    tms9918->tileCacheColorAddr = dec->colorTableAddr;
+    tms9918->tileCacheColorSize = gfxII ? TILE_CACHE_ENTRIES : 256 / GFXI_COLOR_GROUP_SIZE;
+    tms9918->tileCacheBgColor = dec->mainBgColor;
+  }
+}
+
+/* Function:  tmsCachedTiles
+ * ----------------------------------------
+ * output a row of graphics tiles from the tile cache, decoding any
+ * tiles which aren't cached yet
+ *
+ * pattRowOffsets: offset of each tile's row in the pattern table
+ */
+static void tmsCachedTiles(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, const uint16_t* pattRowOffsets, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  tmsTileCacheSync(tms9918, dec);
+
+  const uint8_t *patternTable = tms9918->vram + dec->patternTableAddr;
+  const uint8_t *colorTable = tms9918->vram + dec->colorTableAddr;
+  const bool gfxII = dec->mode == TMS_MODE_GRAPHICS_II;
+
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+  {
+    const uint16_t offset = pattRowOffsets[tileX];
+    uint64_t* valid = &tms9918->tileCacheValid[offset / DIRTY_WORD_BITS];
+    const uint64_t bit = 1ull << (offset % DIRTY_WORD_BITS);
+
+    if ((*valid & bit) == 0)
+    {
+      /* graphics I has a color byte per 8 patterns (64 pattern rows) */
+      const uint8_t colorByte = gfxII ? colorTable[offset] : colorTable[offset / (PATTERN_BYTES * GFXI_COLOR_GROUP_SIZE)];
+
+      tmsExpandPattern(tms9918->tileCache[offset], patternTable[offset],
+                       tmsFgColor(dec->mainBgColor, colorByte),
+                       tmsBgColor(dec->mainBgColor, colorByte));
+      *valid |= bit;
+    }
+
+    memcpy(pixels + tileX * GRAPHICS_CHAR_WIDTH, tms9918->tileCache[offset], GRAPHICS_CHAR_WIDTH);
+  }
+}
+
+/* Function:  vrEmuTms9918GraphicsIScanLine
+ * ----------------------------------------
+ * generate a Graphics I mode scanline
+ */
+static void vrEmuTms9918GraphicsIScanLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
+  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+
+  /* address in name table at the start of this row */
+  const uint16_t rowNamesAddr = dec->nameTableAddr + tileY * GRAPHICS_NUM_COLS;
+
+  const uint8_t *patternTable = tms9918->vram + dec->patternTableAddr;
+  const uint8_t *colorTable = tms9918->vram + dec->colorTableAddr;
+
+  if (dec->useTileCache)
+  {
+    uint16_t pattRowOffsets[GRAPHICS_NUM_COLS];
+    for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    {
+      pattRowOffsets[tileX] = tms9918->vram[rowNamesAddr + tileX] * PATTERN_BYTES + pattRow;
+    }
+
+    tmsCachedTiles(tms9918, dec, pattRowOffsets, pixels);
+  }
+  else
+  {
+    uint8_t pattBytes[GRAPHICS_NUM_COLS];
+    uint8_t colorBytes[GRAPHICS_NUM_COLS];
+
+    /* fetch the pattern and color of each tile in this row */
+    for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    {
+      const uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];    
+      pattBytes[tileX] = patternTable[pattIdx * PATTERN_BYTES + pattRow];
+      colorBytes[tileX] = colorTable[pattIdx / GFXI_COLOR_GROUP_SIZE];
+    }
+
+    tms9918->tileKernel(pattBytes, colorBytes, dec->mainBgColor, pixels);
+  }
+}
+
+/* Function:  vrEmuTms9918GraphicsIIScanLine
+ * ----------------------------------------
+ * generate a Graphics II mode scanline
+ */
+static void vrEmuTms9918GraphicsIIScanLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
+  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+
+  /* address in name table at the start of this row */
+  const uint16_t rowNamesAddr = dec->nameTableAddr + tileY * GRAPHICS_NUM_COLS;
+
+  const bool invalidGfxII = dec->invalidGfxII;
+
+  const uint16_t pageThird = (tileY & 0x18) >> 3; /* which page? 0-2 */
+  const uint16_t pageOffset = (uint16_t)(invalidGfxII ? 0 : pageThird << 11); /* offset (0, 0x800 or 0x1000) */
+
+  const uint8_t *patternTable = tms9918->vram + dec->patternTableAddr + pageOffset;
+  const uint8_t *colorTable = tms9918->vram + dec->colorTableAddr + pageOffset;
+
+  uint16_t pattRowOffsets[GRAPHICS_NUM_COLS];
+
+  /* locate the pattern row of each tile in this row */
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+  {
+    uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];
+
+    if (invalidGfxII)
+    {
+      pattIdx &= 0x07;
+    }
+
+    pattRowOffsets[tileX] = pattIdx * PATTERN_BYTES + pattRow;
+  }
+
+  if (dec->useTileCache)
+  {
+    /* cache entries are indexed from the start of the (first third of the) tables */
+    for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    {
+      pattRowOffsets[tileX] += pageOffset;
+    }
+
+    tmsCachedTiles(tms9918, dec, pattRowOffsets, pixels);
+  }
+  else
+  {
+    uint8_t pattBytes[GRAPHICS_NUM_COLS];
+    uint8_t colorBytes[GRAPHICS_NUM_COLS];
+
+    /* fetch the pattern and color of each tile in this row */
+    for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+    {
+      pattBytes[tileX] = patternTable[pattRowOffsets[tileX]];
+      colorBytes[tileX] = colorTable[pattRowOffsets[tileX]];
+    }
+
+    tms9918->tileKernel(pattBytes, colorBytes, dec->mainBgColor, pixels);
+  }
+}
+
+/* Function:  vrEmuTms9918TextScanLine
+ * ----------------------------------------
+ * generate a Text mode scanline
+ */
+static void vrEmuTms9918TextScanLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  const uint8_t tileY = y >> 3;   /* which name table row (0 - 23) */
+  const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+
+  /* address in name table at the start of this row */
+  const uint16_t rowNamesAddr = dec->nameTableAddr + tileY * TEXT_NUM_COLS;
+  const uint8_t *patternTable = tms9918->vram + dec->patternTableAddr;
+
+  const vrEmuTms9918Color bgColor = dec->mainBgColor;
+  const vrEmuTms9918Color fgColor = dec->mainFgColor;
+  
+  uint8_t pattBytes[TEXT_NUM_COLS];
+
+  /* fetch the pattern of each glyph in this row */
+  for (uint8_t tileX = 0; tileX < TEXT_NUM_COLS; ++tileX)
+  {
+    const uint8_t pattIdx = tms9918->vram[rowNamesAddr + tileX];
+    pattBytes[tileX] = patternTable[pattIdx * PATTERN_BYTES + pattRow];
+  }
+
+  tms9918->textKernel(pattBytes, fgColor, bgColor, pixels + TEXT_PADDING_PX);
+
+  /* fill the first and last 8 pixels with bg color */
+  memset(pixels, bgColor, TEXT_PADDING_PX);
+  memset(pixels + TMS9918_PIXELS_X - TEXT_PADDING_PX, bgColor, TEXT_PADDING_PX);
+}
+
+/* Function:  vrEmuTms9918MulticolorScanLine
+ * ----------------------------------------
+ * generate a Multicolor mode scanline
+ */
+static void vrEmuTms9918MulticolorScanLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  const uint8_t tileY = y >> 3;
+  const uint8_t pattRow = ((y / 4) & 0x01) + (tileY & 0x03) * 2;
+
+  const uint16_t namesAddr = dec->nameTableAddr + tileY * GRAPHICS_NUM_COLS;
+  const uint8_t *patternTable = tms9918->vram + dec->patternTableAddr;
+
+  /* each multicolor block is a tile with its left half (fg) set */
+  static const uint8_t blockPattBytes[GRAPHICS_NUM_COLS] = {
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0,
+    0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0
+  };
+  uint8_t colorBytes[GRAPHICS_NUM_COLS];
+
+  for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+  {
+    const uint8_t pattIdx = tms9918->vram[namesAddr + tileX];
+    colorBytes[tileX] = patternTable[pattIdx * PATTERN_BYTES + pattRow];
+  }
+
+  tms9918->tileKernel(blockPattBytes, colorBytes, dec->mainBgColor, pixels);
+}
+
+/* Function:  tmsScanLineFn
+ * ----------------------------------------
+ * scanline renderer for a display mode
+ */
+static vrEmuTms9918ScanLineFn tmsScanLineFn(vrEmuTms9918Mode mode)
+{
+  switch (mode)
+  {
+    case TMS_MODE_GRAPHICS_II:
+      return vrEmuTms9918GraphicsIIScanLine;
+
+    case TMS_MODE_TEXT:
+      return vrEmuTms9918TextScanLine;
+
+    case TMS_MODE_MULTICOLOR:
+      return vrEmuTms9918MulticolorScanLine;
+
+    default:
+      break;
+  }
+  return vrEmuTms9918GraphicsIScanLine;
+}
+
+
+/* Function:  tmsConvertLine
+ * ----------------------------------------
+ * convert a scanline of palette indexes to a pixel format
+ */
+static void tmsConvertLine(VrEmuTms9918* tms9918, const uint8_t indexes[TMS9918_PIXELS_X], uint8_t* out, vrEmuTms9918PixelFormat format)
+{
+  switch (format)
+  {
+    case TMS_PIXEL_FORMAT_INDEX:
+      if (out != indexes)
+      {
+        memcpy(out, indexes, TMS9918_PIXELS_X);
+      }
+      break;
+
+    case TMS_PIXEL_FORMAT_RGBA8888:
+    case TMS_PIXEL_FORMAT_BGRA8888:
+    {
+      const uint32_t* palette = (format == TMS_PIXEL_FORMAT_RGBA8888) ? tms9918->paletteRgba : tms9918->paletteBgra;
+      for (int x = 0; x < TMS9918_PIXELS_X; ++x, out += 4)
+      {
+        memcpy(out, &palette[indexes[x] & 0x0f], 4);
+      }
+      break;
+    }
+
+    case TMS_PIXEL_FORMAT_RGB24:
+      for (int x = 0; x < TMS9918_PIXELS_X; ++x, out += 3)
+      {
+        memcpy(out, tms9918->paletteRgb24[indexes[x] & 0x0f], 3);
+      }
+      break;
+
+    case TMS_PIXEL_FORMAT_RGB565:
+      for (int x = 0; x < TMS9918_PIXELS_X; ++x, out += 2)
+      {
+        memcpy(out, &tms9918->paletteRgb565[indexes[x] & 0x0f], 2);
+      }
+      break;
+
+    case TMS_PIXEL_FORMAT_RGBA32:
+      for (int x = 0; x < TMS9918_PIXELS_X; ++x, out += 4)
+      {
+        memcpy(out, tms9918->paletteRgba32[indexes[x] & 0x0f], 4);
+      }
+      break;
+  }
+}
+
+/* Function:  vrEmuTms9918ScanLine
+ * ----------------------------------------
+ * generate a scanline
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X])
+{
+  vrEmuTms9918ScanLineFormat(tms9918, y, pixels, TMS_PIXEL_FORMAT_INDEX);
+}
+
+/* Function:  tmsRenderLine
+ * ----------------------------------------
+ * generate an active scanline in the given pixel format
+ */
+static void tmsRenderLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, uint8_t* status, void* pixels, vrEmuTms9918PixelFormat format)
+{
+  uint8_t scanline[TMS9918_PIXELS_X];
+  uint8_t* indexes = (format == TMS_PIXEL_FORMAT_INDEX) ? (uint8_t*)pixels : scanline;
+
+  if (dec->displayEnabled)
+  {
+    tmsScanLineFn(dec->mode)(tms9918, dec, y, indexes);
+    tmsOutputLineSprites(tms9918, dec, y, status, indexes);
+  }
+  else
+  {
+    memset(indexes, dec->mainBgColor, TMS9918_PIXELS_X);
+  }
+  tmsConvertLine(tms9918, indexes, pixels, format);
+}
+
+/* Function:  vrEmuTms9918ScanLineFormat
+ * ----------------------------------------
+ * generate a scanline in the given pixel format
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918ScanLineFormat(VrEmuTms9918* tms9918, uint8_t y, void* pixels, vrEmuTms9918PixelFormat format)
+{
+  if (tms9918 == NULL)
+    return;
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  /* palette indexes are rendered in place, other formats
+     are converted while the line is still in cache */
+  uint8_t scanline[TMS9918_PIXELS_X];
+  uint8_t* indexes = (format == TMS_PIXEL_FORMAT_INDEX) ? (uint8_t*)pixels : scanline;
+
+  if (!dec.displayEnabled || y >= TMS9918_PIXELS_Y)
+  {
+    memset(indexes, dec.mainBgColor, TMS9918_PIXELS_X);
+    tmsConvertLine(tms9918, indexes, pixels, format);
+    return;
+  }
+
+  const uint8_t status = tms9918->status;
+
+  tmsRenderLine(tms9918, &dec, y, &tms9918->status, pixels, format);
+
+  if (tms9918->timing != TMS_TIMING_HOST)
+  {
+    /* status belongs to vrEmuTms9918Clock() */
+    tms9918->status = status;
+  }
+  else if (y == TMS9918_PIXELS_Y - 1)
+  {
+    tms9918->status |= STATUS_INT;
+  }
+}
+
+/* Function:  vrEmuTms9918RenderFrame
+ * ----------------------------------------
+ * generate all scanlines of a frame
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918RenderFrame(VrEmuTms9918* tms9918, uint8_t* pixels, size_t pitch)
+{
+  vrEmuTms9918RenderFrameFormat(tms9918, pixels, pitch, TMS_PIXEL_FORMAT_INDEX);
+}
+
+/* Function:  tmsRenderFrameReplay
+ * ----------------------------------------
+ * generate a frame, replaying the change log at each scanline
+ *
+ * vram and registers are rewound to the start of the frame, then
+ * each change is re-applied before the first scanline it affects
+ */
+static void tmsRenderFrameReplay(VrEmuTms9918* tms9918, uint8_t* out, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  const vrEmuTms9918Change* changeLog = tms9918->changeLog;
+  const size_t changeLogSize = tms9918->changeLogSize;
+  const uint8_t status = tms9918->status;
+
+  for (size_t i = changeLogSize; i-- > 0; )
+  {
+    tmsApplyChange(tms9918, &changeLog[i], false);
+  }
+
+  size_t next = 0;
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    /* register changes refresh the decoded registers */
+    for (; next < changeLogSize && changeLog[next].line <= y; ++next)
+    {
+      tmsApplyChange(tms9918, &changeLog[next], true);
+    }
+
+    tmsRenderLine(tms9918, &tms9918->decoded, y, &tms9918->status, out + y * pitch, format);
+  }
+
+  /* changes made after the last active line */
+  for (; next < changeLogSize; ++next)
+  {
+    tmsApplyChange(tms9918, &changeLog[next], true);
+  }
+
+  tms9918->status = status;
+}
+
+/* Function:  tmsChangeLogVblank
+ * ----------------------------------------
+ * were any logged changes made after the last active line?
+ *
+ * lines only increase through a frame, so these end the log
+ */
+static inline bool tmsChangeLogVblank(VrEmuTms9918* tms9918)
+{
+  return !tms9918->changeLogOverflow && tms9918->changeLogSize &&
+         tms9918->changeLog[tms9918->changeLogSize - 1].line >= TMS9918_PIXELS_Y;
+}
+
+/* Function:  tmsRewindVblankChanges
+ * ----------------------------------------
+ * undo the changes made after the last active line (none of them show
+ * in this frame) and drop them from the log until they're restored
+ *
+ * returns the full size of the log, for tmsRestoreVblankChanges()
+ */
+static size_t tmsRewindVblankChanges(VrEmuTms9918* tms9918)
+{
+  const size_t changeLogSize = tms9918->changeLogSize;
+
+  while (tmsChangeLogVblank(tms9918))
+  {
+    const vrEmuTms9918Change* change = &tms9918->changeLog[--tms9918->changeLogSize];
+    tmsApplyChange(tms9918, change, false);
+  }
+
+  return changeLogSize;
+}
+
+/* Function:  tmsRestoreVblankChanges
+ * ----------------------------------------
+ * re-apply the changes undone by tmsRewindVblankChanges()
+ */
+static void tmsRestoreVblankChanges(VrEmuTms9918* tms9918, size_t changeLogSize)
+{
+  for (; tms9918->changeLogSize < changeLogSize; ++tms9918->changeLogSize)
+  {
+    const vrEmuTms9918Change* change = &tms9918->changeLog[tms9918->changeLogSize];
+    tmsApplyChange(tms9918, change, true);
+  }
+}
+
+/* Function:  tmsRenderFrameState
+ * ----------------------------------------
+ * generate all scanlines of a frame from the current vram and registers
+ */
+static void tmsRenderFrameState(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  uint8_t scanline[TMS9918_PIXELS_X];
+  uint8_t* out = (uint8_t*)pixels;
+
+  if (!dec.displayEnabled)
+  {
+    memset(scanline, dec.mainBgColor, TMS9918_PIXELS_X);
+    for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+    {
+      tmsConvertLine(tms9918, scanline, out + y * pitch, format);
+    }
+    return;
+  }
+
+  const vrEmuTms9918ScanLineFn scanLineFn = tmsScanLineFn(dec.mode);
+  const vrEmuTms9918SpriteFn spriteFn = tmsSpriteFn(&dec);
+  const bool sprites = dec.mode != TMS_MODE_TEXT;
+  const uint8_t status = tms9918->status;
+
+  vrEmuTms9918SpriteLine spriteLines[TMS9918_PIXELS_Y];
+  if (sprites)
+  {
+    tmsSelectSpriteFrame(tms9918, &dec, spriteLines);
+  }
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    uint8_t* line = out + y * pitch;
+    uint8_t* indexes = (format == TMS_PIXEL_FORMAT_INDEX) ? line : scanline;
+
+    scanLineFn(tms9918, &dec, y, indexes);
+    if (sprites)
+    {
+      spriteFn(tms9918, &dec, y, &spriteLines[y], &tms9918->status, indexes);
+    }
+    tmsConvertLine(tms9918, indexes, line, format);
+  }
+
+  if (tms9918->timing != TMS_TIMING_HOST)
+  {
+    /* status belongs to vrEmuTms9918Clock() */
+    tms9918->status = status;
+  }
+  else
+  {
+    tms9918->status |= STATUS_INT;
+  }
+}
+
+/* Function:  vrEmuTms9918RenderFrameFormat
+ * ----------------------------------------
+ * generate all scanlines of a frame in the given pixel format
+ *
+ * registers are decoded once for the whole frame. with host timing, the
+ * status register is updated exactly as 192 calls to vrEmuTms9918ScanLine()
+ * would. with clocked timing it is left to vrEmuTms9918Clock(), changes
+ * made part way through the frame show from the right scanline and
+ * changes made after the last active line don't show at all
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918RenderFrameFormat(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  if (tms9918 == NULL || pixels == NULL)
+    return;
+
+  if (tms9918->changeLogMidFrame && !tms9918->changeLogOverflow)
+  {
+    tmsRenderFrameReplay(tms9918, (uint8_t*)pixels, pitch, format);
+    return;
+  }
+
+  const size_t changeLogSize = tmsRewindVblankChanges(tms9918);
+  tmsRenderFrameState(tms9918, pixels, pitch, format);
+  tmsRestoreVblankChanges(tms9918, changeLogSize);
+}
+
+/* Function:  tmsVramBitDirty
+ * ----------------------------------------
+ * has a vram byte changed since the last frame update?
+ */
+static inline bool tmsVramBitDirty(VrEmuTms9918* tms9918, uint16_t addr)
+{
+  addr &= VRAM_MASK;
+  return (tms9918->vramDirty[addr / DIRTY_WORD_BITS] >> (addr % DIRTY_WORD_BITS)) & 1;
+}
+
+/* Function:  tmsVramRangeDirty
+ * ----------------------------------------
+ * has any vram byte in a range changed since the last frame update?
+ *
+ * ranges wrap at the end of vram, as the renderers' reads do
+ */
+static bool tmsVramRangeDirty(VrEmuTms9918* tms9918, uint16_t addr, uint16_t numBytes)
+{
+  uint32_t start = addr & VRAM_MASK;
+  uint32_t remaining = numBytes;
+
+  while (remaining)
+  {
+    const uint32_t bit = start % DIRTY_WORD_BITS;
+    const uint32_t count = (remaining < DIRTY_WORD_BITS - bit) ? remaining : DIRTY_WORD_BITS - bit;
+    const uint64_t mask = (count == DIRTY_WORD_BITS) ? ~0ull : ((1ull << count) - 1) << bit;
+
+    if (tms9918->vramDirty[start / DIRTY_WORD_BITS] & mask)
+      return true;
+
+    start = (start + count) & VRAM_MASK;
+    remaining -= count;
+  }
+  return false;
+}
+
+/* Function:  tmsSetLines
+ * ----------------------------------------
+ * mark a range of scanlines (clipped to the display)
+ */
+static void tmsSetLines(uint64_t lines[FRAME_LINE_WORDS], int first, int numLines)
+{
+  for (int y = (first < 0) ? 0 : first; y < first + numLines && y < TMS9918_PIXELS_Y; ++y)
+  {
+    lines[y / DIRTY_WORD_BITS] |= 1ull << (y % DIRTY_WORD_BITS);
+  }
+}
+
+/* Function:  tmsSpriteLines
+ * ----------------------------------------
+ * which scanlines have at least one sprite on them
+ */
+static void tmsSpriteLines(const vrEmuTms9918SpriteLine spriteLines[TMS9918_PIXELS_Y], uint64_t lines[FRAME_LINE_WORDS])
+{
+  memset(lines, 0, FRAME_LINE_WORDS * sizeof(uint64_t));
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    if (spriteLines[y].numSprites)
+    {
+      tmsSetLines(lines, y, 1);
+    }
+  }
+}
+
+/* Function:  tmsSpriteStatusLine
+ * ----------------------------------------
+ * update the status register for a scanline's sprites without
+ * producing any output
+ */
+static void tmsSpriteStatusLine(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, uint8_t y, const vrEmuTms9918SpriteLine* line)
+{
+  tmsSpriteFn(dec)(tms9918, dec, y, line, &tms9918->status, NULL);
+}
+
+/* Function:  tmsDirtyLines
+ * ----------------------------------------
+ * which scanlines are affected by vram changes since the last frame update
+ */
+static void tmsDirtyLines(VrEmuTms9918* tms9918, const vrEmuTms9918Decoded* dec, const uint64_t spriteLines[FRAME_LINE_WORDS], uint64_t lines[FRAME_LINE_WORDS])
+{
+  memset(lines, 0, FRAME_LINE_WORDS * sizeof(uint64_t));
+
+  const bool textMode = dec->mode == TMS_MODE_TEXT;
+  const uint8_t numCols = textMode ? TEXT_NUM_COLS : GRAPHICS_NUM_COLS;
+  const uint16_t tablesSize = (dec->mode == TMS_MODE_GRAPHICS_II) ? 0x1800 : 0x800;
+
+  /* name table rows */
+  for (uint8_t tileY = 0; tileY < GRAPHICS_NUM_ROWS; ++tileY)
+  {
+    if (tmsVramRangeDirty(tms9918, dec->nameTableAddr + tileY * numCols, numCols))
+    {
+      tmsSetLines(lines, tileY * PATTERN_BYTES, PATTERN_BYTES);
+    }
+  }
+
+  /* pattern and color entries referenced by each line */
+  const bool patternsDirty = tmsVramRangeDirty(tms9918, dec->patternTableAddr, tablesSize);
+  bool colorsDirty = false;
+  if (dec->mode == TMS_MODE_GRAPHICS_I)
+  {
+    colorsDirty = tmsVramRangeDirty(tms9918, dec->colorTableAddr, 256 / GFXI_COLOR_GROUP_SIZE);
+  }
+  else if (dec->mode == TMS_MODE_GRAPHICS_II)
+  {
+    colorsDirty = tmsVramRangeDirty(tms9918, dec->colorTableAddr, tablesSize);
+  }
+
+  if (patternsDirty || colorsDirty)
+  {
+    for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+    {
+      const uint8_t tileY = y >> 3;
+      const uint16_t rowNamesAddr = dec->nameTableAddr + tileY * numCols;
+
+      uint8_t pattRow = y & 0x07;
+      uint16_t pageOffset = 0;
+      if (dec->mode == TMS_MODE_MULTICOLOR)
+      {
+        pattRow = ((y / 4) & 0x01) + (tileY & 0x03) * 2;
+      }
+      else if (dec->mode == TMS_MODE_GRAPHICS_II && !dec->invalidGfxII)
+      {
+        pageOffset = (uint16_t)(((tileY & 0x18) >> 3) << 11);
+      }
+
+      for (uint8_t tileX = 0; tileX < numCols; ++tileX)
+      {
+        uint8_t pattIdx = tms9918->vram[(rowNamesAddr + tileX) & VRAM_MASK];
+        if (dec->mode == TMS_MODE_GRAPHICS_II && dec->invalidGfxII)
+        {
+          pattIdx &= 0x07;
+        }
+
+        const uint16_t pattRowOffset = pageOffset + pattIdx * PATTERN_BYTES + pattRow;
+        bool dirty = tmsVramBitDirty(tms9918, dec->patternTableAddr + pattRowOffset);
+
+        if (dec->mode == TMS_MODE_GRAPHICS_I)
+        {
+          dirty = dirty || tmsVramBitDirty(tms9918, dec->colorTableAddr + pattIdx / GFXI_COLOR_GROUP_SIZE);
+        }
+        else if (dec->mode == TMS_MODE_GRAPHICS_II)
+        {
+          dirty = dirty || tmsVramBitDirty(tms9918, dec->colorTableAddr + pattRowOffset);
+        }
+
+        if (dirty)
+        {
+          tmsSetLines(lines, y, 1);
+          break;
+        }
+      }
+    }
+  }
+
+  /* sprites: lines they covered last frame and the lines they cover now */
+  if (!textMode &&
+      (tmsVramRangeDirty(tms9918, dec->spriteAttrTableAddr, MAX_SPRITES * SPRITE_ATTR_BYTES) ||
+       tmsVramRangeDirty(tms9918, dec->spritePatternTableAddr, SPRITE_PATT_BYTES)))
+  {
+    for (int i = 0; i < FRAME_LINE_WORDS; ++i)
+    {
+      lines[i] |= tms9918->lastFrameSpriteLines[i] | spriteLines[i];
+    }
+  }
+}
+
+/* Function:  vrEmuTms9918RenderFrameUpdate
+ * ----------------------------------------
+ * generate a frame, re-rendering only the scanlines affected by
+ * changes since the previous call
+ */
+VR_EMU_TMS9918_DLLEXPORT int vrEmuTms9918RenderFrameUpdate(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  if (tms9918 == NULL || pixels == NULL)
+    return 0;
+
+  if (tms9918->changeLogMidFrame && !tms9918->changeLogOverflow)
+  {
+    /* the frame doesn't match any single state. redraw it all, and again next time */
+    vrEmuTms9918RenderFrameFormat(tms9918, pixels, pitch, format);
+    tms9918->lastFrameValid = false;
+    return TMS9918_PIXELS_Y;
+  }
+
+  /* the frame is the state before them. they're new changes next time */
+  const size_t changeLogSize = tmsRewindVblankChanges(tms9918);
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  const bool sprites = dec.mode != TMS_MODE_TEXT;
+
+  vrEmuTms9918SpriteLine frameSprites[TMS9918_PIXELS_Y];
+  uint64_t spriteLines[FRAME_LINE_WORDS] = { 0 };
+  if (sprites)
+  {
+    tmsSelectSpriteFrame(tms9918, &dec, frameSprites);
+    tmsSpriteLines(frameSprites, spriteLines);
+  }
+
+  int linesRendered = TMS9918_PIXELS_Y;
+
+  const bool sameFrame = tms9918->lastFrameValid &&
+                         tms9918->lastFramePixels == pixels &&
+                         tms9918->lastFramePitch == pitch &&
+                         tms9918->lastFrameFormat == format &&
+                         memcmp(&tms9918->lastFrameDecoded, &dec, sizeof(dec)) == 0;
+
+  if (!sameFrame || !dec.displayEnabled)
+  {
+    vrEmuTms9918RenderFrameFormat(tms9918, pixels, pitch, format);
+  }
+  else
+  {
+    uint64_t dirtyLines[FRAME_LINE_WORDS];
+    tmsDirtyLines(tms9918, &dec, spriteLines, dirtyLines);
+
+    const vrEmuTms9918ScanLineFn scanLineFn = tmsScanLineFn(dec.mode);
+    const vrEmuTms9918SpriteFn spriteFn = tmsSpriteFn(&dec);
+    const bool hostTiming = tms9918->timing == TMS_TIMING_HOST;
+    const uint8_t status = tms9918->status;
+    uint8_t scanline[TMS9918_PIXELS_X];
+    uint8_t* out = (uint8_t*)pixels;
+
+    linesRendered = 0;
+    for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+    {
+      if ((dirtyLines[y / DIRTY_WORD_BITS] >> (y % DIRTY_WORD_BITS)) & 1)
+      {
+        uint8_t* line = out + y * pitch;
+        uint8_t* indexes = (format == TMS_PIXEL_FORMAT_INDEX) ? line : scanline;
+
+        scanLineFn(tms9918, &dec, y, indexes);
+        if (sprites)
+        {
+          spriteFn(tms9918, &dec, y, &frameSprites[y], &tms9918->status, indexes);
+        }
+        tmsConvertLine(tms9918, indexes, line, format);
+        ++linesRendered;
+      }
+      else if (sprites && hostTiming)
+      {
+        /* line is unchanged, but its sprites still affect the status register */
+        tmsSpriteStatusLine(tms9918, &dec, y, &frameSprites[y]);
+      }
+    }
+
+    if (!hostTiming)
+    {
+      /* status belongs to vrEmuTms9918Clock() */
+      tms9918->status = status;
+    }
+    else
+    {
+      tms9918->status |= STATUS_INT;
+    }
+  }
+
+  memset(tms9918->vramDirty, 0, sizeof(tms9918->vramDirty));
+  memcpy(tms9918->lastFrameSpriteLines, spriteLines, sizeof(spriteLines));
+  tms9918->lastFrameDecoded = dec;
+  tms9918->lastFramePixels = pixels;
+  tms9918->lastFramePitch = pitch;
+  tms9918->lastFrameFormat = format;
+  tms9918->lastFrameValid = true;
+
+  tmsRestoreVblankChanges(tms9918, changeLogSize);
+
+  return linesRendered;
+}
+
+/* Function:  vrEmuTms9918RenderLines
+ * ----------------------------------------
+ * generate a range of scanlines without touching the status register
+ *
+ * nothing in the instance is modified (the caches are bypassed), so
+ * disjoint ranges of a frame can be rendered from several threads
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918RenderLines(VrEmuTms9918* tms9918, uint8_t firstLine, uint8_t numLines, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  if (tms9918 == NULL || pixels == NULL)
+    return;
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+  dec.useTileCache = false;
+  dec.useSpriteCache = false;
+
+  /* sprite status is produced by vrEmuTms9918FrameStatus() instead */
+  dec.collisions = COLLISIONS_SKIP;
+  uint8_t status = 0;
+
+  uint8_t* out = (uint8_t*)pixels;
+  const uint16_t endLine = (firstLine + numLines < TMS9918_PIXELS_Y) ? firstLine + numLines : TMS9918_PIXELS_Y;
+
+  for (uint16_t y = firstLine; y < endLine; ++y)
+  {
+    tmsRenderLine(tms9918, &dec, (uint8_t)y, &status, out + y * pitch, format);
+  }
+}
+
+/* Function:  vrEmuTms9918ScanLineStatus
+ * ----------------------------------------
+ * update the status register as vrEmuTms9918ScanLine() would, without
+ * producing any output
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918ScanLineStatus(VrEmuTms9918* tms9918, uint8_t y)
+{
+  if (tms9918 == NULL || tms9918->timing != TMS_TIMING_HOST)
+    return;
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  if (!dec.displayEnabled || y >= TMS9918_PIXELS_Y)
+    return;
+
+  if (dec.mode != TMS_MODE_TEXT)
+  {
+    vrEmuTms9918SpriteLine line;
+    tmsSelectSpriteLine(tms9918, &dec, y, &line);
+    tmsSpriteStatusLine(tms9918, &dec, y, &line);
+  }
+
+  if (y == TMS9918_PIXELS_Y - 1)
+  {
+    tms9918->status |= STATUS_INT;
+  }
+}
+
+/* Function:  vrEmuTms9918FrameStatus
+ * ----------------------------------------
+ * update the status register for a frame without producing any output
+ */
+VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918FrameStatus(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL)
+    return 0;
+
+  if (tms9918->timing == TMS_TIMING_HOST)
+  {
+    vrEmuTms9918Decoded dec = tms9918->decoded;
+
+    if (dec.displayEnabled)
+    {
+      if (dec.mode != TMS_MODE_TEXT)
+      {
+        /* the status is returned, so there's nothing to gain by deferring
+           collisions. line 0 resets the status, dropping any deferred lines */
+        dec.collisions = COLLISIONS_EAGER;
+        tms9918->collisionsPending = false;
+        memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+
+        vrEmuTms9918SpriteLine spriteLines[TMS9918_PIXELS_Y];
+        tmsSelectSpriteFrame(tms9918, &dec, spriteLines);
+
+        /* in scanline order, as the frame renderers do. once 5S and
+           COL are both set, later lines can't change anything */
+        for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+        {
+          tmsSpriteStatusLine(tms9918, &dec, y, &spriteLines[y]);
+
+          if ((tms9918->status & (STATUS_5S | STATUS_COL)) == (STATUS_5S | STATUS_COL))
+            break;
+        }
+      }
+
+      tms9918->status |= STATUS_INT;
+    }
+  }
+
+  return vrEmuTms9918StatusValue(tms9918);
+}
+
+/* a frame being rendered by vrEmuTms9918RenderFrameRanges() */
+typedef struct
+{
+  VrEmuTms9918* tms9918;
+  uint8_t* pixels;
+  size_t pitch;
+  vrEmuTms9918PixelFormat format;
+  unsigned numRanges;
+} vrEmuTms9918FrameRanges;
+
+/* Function:  tmsRenderFrameRange
+ * ----------------------------------------
+ * generate one range of scanlines of a vrEmuTms9918FrameRanges frame
+ */
+static void tmsRenderFrameRange(void* frame, unsigned range)
+{
+  const vrEmuTms9918FrameRanges* ranges = (const vrEmuTms9918FrameRanges*)frame;
+
+  if (range >= ranges->numRanges)
+    return;
+
+  const unsigned firstLine = TMS9918_PIXELS_Y * range / ranges->numRanges;
+  const unsigned endLine = TMS9918_PIXELS_Y * (range + 1) / ranges->numRanges;
+
+  vrEmuTms9918RenderLines(ranges->tms9918, (uint8_t)firstLine, (uint8_t)(endLine - firstLine),
+                          ranges->pixels, ranges->pitch, ranges->format);
+}
+
+/* Function:  vrEmuTms9918RenderFrameRanges
+ * ----------------------------------------
+ * generate a frame as ranges of scanlines (possibly in parallel), then
+ * update the status register in scanline order
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918RenderFrameRanges(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format,
+                                                            unsigned numRanges, vrEmuTms9918ParallelFn parallel, void* context)
+{
+  if (tms9918 == NULL || pixels == NULL)
+    return;
+
+  /* changes part way through the frame are replayed a line at a time */
+  if (parallel == NULL || numRanges < 2 || (tms9918->changeLogMidFrame && !tms9918->changeLogOverflow))
+  {
+    vrEmuTms9918RenderFrameFormat(tms9918, pixels, pitch, format);
+    return;
+  }
+
+  if (numRanges > TMS9918_PIXELS_Y)
+  {
+    numRanges = TMS9918_PIXELS_Y;
+  }
+
+  const size_t changeLogSize = tmsRewindVblankChanges(tms9918);
+
+  vrEmuTms9918FrameRanges frame;
+  frame.tms9918 = tms9918;
+  frame.pixels = (uint8_t*)pixels;
+  frame.pitch = pitch;
+  frame.format = format;
+  frame.numRanges = numRanges;
+  parallel(context, numRanges, tmsRenderFrameRange, &frame);
+
+  /* leaves the status alone with clocked timing, as rendering does */
+  vrEmuTms9918FrameStatus(tms9918);
+
+  tmsRestoreVblankChanges(tms9918, changeLogSize);
+}
+
+/* Function:  tmsRenderBatchLanes
+ * ----------------------------------------
+ * generate a frame for up to BATCH_LANES Graphics I/II instances,
+ * one scanline across all lanes per pass
+ *
+ * vram stays in each instance. the pattern and color bytes of each
+ * lane are gathered into [tile][lane] arrays and expanded lane-parallel
+ */
+static void tmsRenderBatchLanes(VrEmuTms9918* const* lanes, void* const* pixels, uint8_t numLanes, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  vrEmuTms9918Decoded dec[BATCH_LANES];
+  uint8_t status[BATCH_LANES];
+  vrEmuTms9918SpriteFn spriteFns[BATCH_LANES];
+  vrEmuTms9918SpriteLine spriteLines[BATCH_LANES][TMS9918_PIXELS_Y];
+
+  uint8_t pattBytes[GRAPHICS_NUM_COLS][BATCH_LANES];
+  uint8_t colorBytes[GRAPHICS_NUM_COLS][BATCH_LANES];
+  uint8_t mainBgColors[BATCH_LANES];
+  uint8_t scanlines[BATCH_LANES][TMS9918_PIXELS_X];
+
+  /* unused lanes expand zeros */
+  memset(pattBytes, 0, sizeof(pattBytes));
+  memset(colorBytes, 0, sizeof(colorBytes));
+  memset(mainBgColors, 0, sizeof(mainBgColors));
+
+  for (uint8_t lane = 0; lane < numLanes; ++lane)
+  {
+    dec[lane] = lanes[lane]->decoded;
+    status[lane] = lanes[lane]->status;
+    mainBgColors[lane] = dec[lane].mainBgColor;
+
+    /* lanes are all graphics I/II, so all have sprites */
+    spriteFns[lane] = tmsSpriteFn(&dec[lane]);
+    tmsSelectSpriteFrame(lanes[lane], &dec[lane], spriteLines[lane]);
+  }
+
+  for (uint8_t y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    const uint8_t tileY = y >> 3;      /* which name table row (0 - 23) */
+    const uint8_t pattRow = y & 0x07;  /* which pattern row (0 - 7) */
+
+    /* gather */
+    for (uint8_t lane = 0; lane < numLanes; ++lane)
+    {
+      const vrEmuTms9918Decoded* d = &dec[lane];
+      const uint8_t* vram = lanes[lane]->vram;
+      const uint8_t* rowNames = vram + d->nameTableAddr + tileY * GRAPHICS_NUM_COLS;
+
+      if (d->mode == TMS_MODE_GRAPHICS_II)
+      {
+        const uint16_t pageOffset = (uint16_t)(d->invalidGfxII ? 0 : ((tileY & 0x18) >> 3) << 11);
+        const uint8_t nameMask = d->invalidGfxII ? 0x07 : 0xff;
+        const uint8_t* patternTable = vram + d->patternTableAddr + pageOffset + pattRow;
+        const uint8_t* colorTable = vram + d->colorTableAddr + pageOffset + pattRow;
+
+        for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+        {
+          const uint16_t offset = (rowNames[tileX] & nameMask) * PATTERN_BYTES;
+          pattBytes[tileX][lane] = patternTable[offset];
+          colorBytes[tileX][lane] = colorTable[offset];
+        }
+      }
+      else
+      {
+        const uint8_t* patternTable = vram + d->patternTableAddr + pattRow;
+        const uint8_t* colorTable = vram + d->colorTableAddr;
+
+        for (uint8_t tileX = 0; tileX < GRAPHICS_NUM_COLS; ++tileX)
+        {
+          const uint8_t pattIdx = rowNames[tileX];
+          pattBytes[tileX][lane] = patternTable[pattIdx * PATTERN_BYTES];
+          colorBytes[tileX][lane] = colorTable[pattIdx / GFXI_COLOR_GROUP_SIZE];
+        }
+      }
+    }
+
+    /* expand */
+    lanes[0]->batchKernel((const uint8_t (*)[BATCH_LANES])pattBytes, (const uint8_t (*)[BATCH_LANES])colorBytes, mainBgColors, scanlines);
+
+    /* sprites and output */
+    for (uint8_t lane = 0; lane < numLanes; ++lane)
+    {
+      spriteFns[lane](lanes[lane], &dec[lane], y, &spriteLines[lane][y], &status[lane], scanlines[lane]);
+      tmsConvertLine(lanes[lane], scanlines[lane], (uint8_t*)pixels[lane] + y * pitch, format);
+    }
+  }
+
+  for (uint8_t lane = 0; lane < numLanes; ++lane)
+  {
+    if (lanes[lane]->timing == TMS_TIMING_HOST)
+    {
+      lanes[lane]->status = status[lane] | STATUS_INT;
+    }
+  }
+}
+
+/* Function:  vrEmuTms9918RenderFrameBatch
+ * ----------------------------------------
+ * generate a frame for each of a group of instances
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918RenderFrameBatch(VrEmuTms9918* const* instances, size_t numInstances, void* const* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  if (instances == NULL || pixels == NULL)
+    return;
+
+  VrEmuTms9918* lanes[BATCH_LANES];
+  void* lanePixels[BATCH_LANES];
+  uint8_t numLanes = 0;
+
+  for (size_t i = 0; i < numInstances; ++i)
+  {
+    VrEmuTms9918* tms9918 = instances[i];
+    if (tms9918 == NULL || pixels[i] == NULL)
+      continue;
+
+    const vrEmuTms9918Mode mode = tms9918->mode;
+    const bool batchable = (mode == TMS_MODE_GRAPHICS_I || mode == TMS_MODE_GRAPHICS_II) &&
+                           tms9918->decoded.displayEnabled &&
+                           !(tms9918->changeLogMidFrame && !tms9918->changeLogOverflow) &&
+                           !tmsChangeLogVblank(tms9918);
+
+    if (!batchable)
+    {
+      vrEmuTms9918RenderFrameFormat(tms9918, pixels[i], pitch, format);
+      continue;
+    }
+
+    lanes[numLanes] = tms9918;
+    lanePixels[numLanes] = pixels[i];
+
+    if (++numLanes == BATCH_LANES)
+    {
+      tmsRenderBatchLanes(lanes, lanePixels, numLanes, pitch, format);
+      numLanes = 0;
+    }
+  }
+
+  if (numLanes)
+  {
+    tmsRenderBatchLanes(lanes, lanePixels, numLanes, pitch, format);
+  }
+}
+
+/* Function:  tmsBeamLineComplete
+ * ----------------------------------------
+ * update the status register as the beam completes a line
+ */
+static void tmsBeamLineComplete(VrEmuTms9918* tms9918, uint16_t y)
+{
+  if (y >= TMS9918_PIXELS_Y)
+    return;
+
+  vrEmuTms9918Decoded dec = tms9918->decoded;
+
+  if (dec.displayEnabled && dec.mode != TMS_MODE_TEXT)
+  {
+    /* a pending interrupt survives the start of the next frame */
+    const uint8_t interrupt = tms9918->status & STATUS_INT;
+
+    vrEmuTms9918SpriteLine line;
+    tmsSelectSpriteLine(tms9918, &dec, (uint8_t)y, &line);
+    tmsSpriteStatusLine(tms9918, &dec, (uint8_t)y, &line);
+
+    tms9918->status |= interrupt;
+  }
+
+  /* vsync. raised even while the display is blanked */
+  if (y == TMS9918_PIXELS_Y - 1)
+  {
+    tms9918->status |= STATUS_INT;
+  }
+}
+
+/* Function:  vrEmuTms9918SetTiming
+ * ----------------------------------------
+ * select how the status register is driven
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918SetTiming(VrEmuTms9918* tms9918, vrEmuTms9918Timing timing)
+{
+  if (tms9918 == NULL) return;
+
+  if (tms9918->collisionsPending)
+  {
+    tmsResolveCollisions(tms9918);
+  }
+
+  tms9918->timing = timing;
+  tmsRefreshDecoded(tms9918);
+  tms9918->beamLine = 0;
+  tms9918->beamClock = 0;
+  tmsClearChangeLog(tms9918);
+}
+
+/* Function:  vrEmuTms9918Clock
+ * ----------------------------------------
+ * advance the beam by a number of pixel clocks
+ */
+VR_EMU_TMS9918_DLLEXPORT bool vrEmuTms9918Clock(VrEmuTms9918* tms9918, uint32_t cycles)
+{
+  if (tms9918 == NULL || tms9918->timing == TMS_TIMING_HOST) return false;
+
+  const uint16_t frameLines = (tms9918->timing == TMS_TIMING_PAL) ? TMS9918_LINES_PAL : TMS9918_LINES_NTSC;
+
+  /* only active lines do any work. whole frames are skipped a line at a time */
+  uint32_t clocks = tms9918->beamClock + cycles;
+  while (clocks >= TMS9918_CLOCKS_PER_LINE)
+  {
+    clocks -= TMS9918_CLOCKS_PER_LINE;
+    tmsBeamLineComplete(tms9918, tms9918->beamLine);
+
+    if (++tms9918->beamLine == frameLines)
+    {
+      tms9918->beamLine = 0;
+      tmsClearChangeLog(tms9918);
+    }
+  }
+  tms9918->beamClock = (uint16_t)clocks;
+
+  return vrEmuTms9918InterruptPending(tms9918);
+}
+
+/* Function:  vrEmuTms9918BeamLine
+ * ----------------------------------------
+ * current beam line
+ */
+VR_EMU_TMS9918_DLLEXPORT uint16_t vrEmuTms9918BeamLine(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL) return 0;
+
+  return tms9918->beamLine;
+}
+
+/* Function:  vrEmuTms9918SetPalette
+ * ----------------------------------------
+ * set the palette used by the formatted renderers
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918SetPalette(VrEmuTms9918* tms9918, const uint32_t palette[TMS9918_NUM_COLORS])
+{
+  if (tms9918 == NULL)
+    return;
+
+  if (palette == NULL)
+  {
+    palette = tmsDefaultPalette;
+  }
+
+  tms9918->lastFrameValid = false;
+
+  for (int i = 0; i < TMS9918_NUM_COLORS; ++i)
+  {
+    const uint32_t rgba = palette[i];
+    const uint8_t r = (uint8_t)(rgba >> 24);
+    const uint8_t g = (uint8_t)(rgba >> 16);
+    const uint8_t b = (uint8_t)(rgba >> 8);
+    const uint8_t a = (uint8_t)rgba;
+
+    tms9918->paletteRgba[i] = rgba;
+    tms9918->paletteBgra[i] = ((uint32_t)b << 24) | ((uint32_t)g << 16) | ((uint32_t)r << 8) | a;
+    tms9918->paletteRgb24[i][0] = r;
+    tms9918->paletteRgb24[i][1] = g;
+    tms9918->paletteRgb24[i][2] = b;
+    tms9918->paletteRgba32[i][0] = r;
+    tms9918->paletteRgba32[i][1] = g;
+    tms9918->paletteRgba32[i][2] = b;
+    tms9918->paletteRgba32[i][3] = a;
+    tms9918->paletteRgb565[i] = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+  }
+}
+
+/* Function:  vrEmuTms9918PixelFormatBytes
+ * ----------------------------------------
+ * return the number of bytes per pixel for a pixel format
+ */
+VR_EMU_TMS9918_DLLEXPORT uint8_t vrEmuTms9918PixelFormatBytes(vrEmuTms9918PixelFormat format)
+{
+  switch (format)
+  {
+    case TMS_PIXEL_FORMAT_RGBA8888:
+    case TMS_PIXEL_FORMAT_BGRA8888:
+    case TMS_PIXEL_FORMAT_RGBA32:
+      return 4;
+
+    case TMS_PIXEL_FORMAT_RGB24:
+      return 3;
+
+    case TMS_PIXEL_FORMAT_RGB565:
+      return 2;
+
+    default:
+      break;
+  }
+  return 1;
+}
+
+/* Function:  vrEmuTms9918EnableTileCache
+ * ----------------------------------------
+ * enable or disable the decoded tile cache
+ */
+VR_EMU_TMS9918_DLLEXPORT bool vrEmuTms9918EnableTileCache(VrEmuTms9918* tms9918, bool enable)
+{
+  if (tms9918 == NULL)
+    return false;
+
+  if (!enable)
+  {
+    free(tms9918->tileCache);
+    tms9918->tileCache = NULL;
+    tmsRefreshDecoded(tms9918);
+    return true;
+  }
+
+  if (tms9918->tileCache == NULL)
+  {
+    tms9918->tileCache = malloc(TILE_CACHE_ENTRIES * sizeof(*tms9918->tileCache));
+    if (tms9918->tileCache == NULL)
+      return false;
+
+    /* nothing cached yet. the next scanline will set the cached tables */
+    memset(tms9918->tileCacheValid, 0, sizeof(tms9918->tileCacheValid));
+    tms9918->tileCacheMode = TMS_MODE_TEXT;
+    tms9918->tileCachePattSize = 0;
+    tms9918->tileCacheColorSize = 0;
+    tmsRefreshDecoded(tms9918);
+  }
+  return true;
+}
+
+/* Function:  tmsRleLiterals
+ * ----------------------------------------
+ * encode a run of up to STATE_RLE_MAX_LITERALS literal bytes
+ * (dest may be NULL to measure). returns the new output size
+ */
+static size_t tmsRleLiterals(const uint8_t* src, size_t numLiterals, uint8_t* dest, size_t destBytes)
+{
+  if (numLiterals == 0)
+    return destBytes;
+
+  if (dest)
+  {
+    dest[destBytes] = (uint8_t)(numLiterals - 1);
+    memcpy(dest + destBytes + 1, src, numLiterals);
+  }
+  return destBytes + 1 + numLiterals;
+}
+
+/* Function:  tmsRleEncode
+ * ----------------------------------------
+ * run-length encode bytes (dest may be NULL to measure)
+ * returns the encoded size
+ */
+static size_t tmsRleEncode(const uint8_t* src, size_t srcBytes, uint8_t* dest)
+{
+  size_t destBytes = 0;
+  size_t numLiterals = 0;
+  size_t i = 0;
+
+  while (i < srcBytes)
+  {
+    size_t run = 1;
+    while (i + run < srcBytes && run < STATE_RLE_MAX_RUN && src[i + run] == src[i])
+      ++run;
+
+    if (run >= STATE_RLE_MIN_RUN)
+    {
+      destBytes = tmsRleLiterals(src + i - numLiterals, numLiterals, dest, destBytes);
+      numLiterals = 0;
+
+      if (dest)
+      {
+        dest[destBytes] = (uint8_t)(STATE_RLE_RUN | (run - STATE_RLE_MIN_RUN));
+        dest[destBytes + 1] = src[i];
+      }
+      destBytes += 2;
+      i += run;
+    }
+    else
+    {
+      ++numLiterals;
+      ++i;
+
+      if (numLiterals == STATE_RLE_MAX_LITERALS)
+      {
+        destBytes = tmsRleLiterals(src + i - numLiterals, numLiterals, dest, destBytes);
+        numLiterals = 0;
+      }
+    }
+  }
+
+  return tmsRleLiterals(src + i - numLiterals, numLiterals, dest, destBytes);
+}
+
+/* Function:  tmsRleDecode
+ * ----------------------------------------
+ * decode run-length encoded bytes (dest may be NULL to validate)
+ * returns false unless src decodes to exactly destBytes bytes
+ */
+static bool tmsRleDecode(const uint8_t* src, size_t srcBytes, uint8_t* dest, size_t destBytes)
+{
+  size_t out = 0;
+  size_t i = 0;
+
+  while (i < srcBytes)
+  {
+    const uint8_t control = src[i++];
+
+    if (control & STATE_RLE_RUN)
+    {
+      const size_t run = (control & ~STATE_RLE_RUN) + STATE_RLE_MIN_RUN;
+      if (i == srcBytes || run > destBytes - out)
+        return false;
+
+      if (dest) memset(dest + out, src[i], run);
+      ++i;
+      out += run;
+    }
+    else
+    {
+      const size_t numLiterals = (size_t)control + 1;
+      if (numLiterals > srcBytes - i || numLiterals > destBytes - out)
+        return false;
+
+      if (dest) memcpy(dest + out, src + i, numLiterals);
+      i += numLiterals;
+      out += numLiterals;
+    }
+  }
+
+  return out == destBytes;
+}
+
+/* Function:  vrEmuTms9918SaveStateSize
+ * ----------------------------------------
+ * return the size of the blob vrEmuTms9918SaveState() would write now
+ */
+VR_EMU_TMS9918_DLLEXPORT
+size_t vrEmuTms9918SaveStateSize(VrEmuTms9918* tms9918, bool compress)
+{
+  if (tms9918 == NULL)
+    return 0;
+
+  return STATE_HEADER_BYTES + (compress ? tmsRleEncode(tms9918->vram, VRAM_SIZE, NULL) : VRAM_SIZE);
+}
+
+/* Function:  vrEmuTms9918SaveState
+ * ----------------------------------------
+ * save the tms9918 state to a versioned blob
+ */
+VR_EMU_TMS9918_DLLEXPORT
+size_t vrEmuTms9918SaveState(VrEmuTms9918* tms9918, uint8_t* buffer, size_t bufferSize, bool compress)
+{
+  if (tms9918 == NULL || buffer == NULL)
+    return 0;
+
+  const size_t size = vrEmuTms9918SaveStateSize(tms9918, compress);
+  if (bufferSize < size)
+    return 0;
+
+  buffer[0] = STATE_MAGIC_0;
+  buffer[1] = STATE_MAGIC_1;
+  buffer[2] = STATE_MAGIC_2;
+  buffer[3] = STATE_MAGIC_3;
+  buffer[4] = TMS9918_STATE_VERSION;
+  buffer[5] = compress ? STATE_FLAG_RLE : 0;
+  memcpy(buffer + 6, tms9918->registers, TMS_NUM_REGISTERS);
+  buffer[14] = vrEmuTms9918StatusValue(tms9918);
+  buffer[15] = tms9918->regWriteStage;
+  buffer[16] = (uint8_t)tms9918->currentAddress;
+  buffer[17] = (uint8_t)(tms9918->currentAddress >> 8);
+  buffer[18] = (uint8_t)tms9918->timing;
+  buffer[19] = (uint8_t)tms9918->beamLine;
+  buffer[20] = (uint8_t)(tms9918->beamLine >> 8);
+  buffer[21] = (uint8_t)tms9918->beamClock;
+  buffer[22] = (uint8_t)(tms9918->beamClock >> 8);
+
+  if (compress)
+  {
+    tmsRleEncode(tms9918->vram, VRAM_SIZE, buffer + STATE_HEADER_BYTES);
+  }
+  else
+  {
+    memcpy(buffer + STATE_HEADER_BYTES, tms9918->vram, VRAM_SIZE);
+  }
+
+  return size;
+}
+
+/* Function:  vrEmuTms9918LoadState
+ * ----------------------------------------
+ * restore a blob written by vrEmuTms9918SaveState()
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918LoadState(VrEmuTms9918* tms9918, const uint8_t* buffer, size_t bufferSize)
+{
+  if (tms9918 == NULL || buffer == NULL || bufferSize < STATE_HEADER_BYTES)
+    return false;
+
+  if (buffer[0] != STATE_MAGIC_0 || buffer[1] != STATE_MAGIC_1 ||
+      buffer[2] != STATE_MAGIC_2 || buffer[3] != STATE_MAGIC_3 ||
+      buffer[4] != TMS9918_STATE_VERSION || (buffer[5] & ~STATE_FLAG_RLE))
+    return false;
+
+  const bool compressed = buffer[5] & STATE_FLAG_RLE;
+  const uint8_t* vram = buffer + STATE_HEADER_BYTES;
+  const size_t vramBytes = bufferSize - STATE_HEADER_BYTES;
+
+  const vrEmuTms9918Timing timing = (vrEmuTms9918Timing)buffer[18];
+  const uint16_t beamLine = (uint16_t)(buffer[19] | (buffer[20] << 8));
+  const uint16_t beamClock = (uint16_t)(buffer[21] | (buffer[22] << 8));
+
+  if (buffer[15] > 1 || timing > TMS_TIMING_PAL || beamClock >= TMS9918_CLOCKS_PER_LINE ||
+      beamLine >= (timing == TMS_TIMING_PAL ? TMS9918_LINES_PAL : TMS9918_LINES_NTSC))
+    return false;
+
+  if (compressed ? !tmsRleDecode(vram, vramBytes, NULL, VRAM_SIZE) : vramBytes < VRAM_SIZE)
+    return false;
+
+  memcpy(tms9918->registers, buffer + 6, TMS_NUM_REGISTERS);
+  tms9918->status = buffer[14];
+  tms9918->collisionsPending = false;
+  memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+  tms9918->regWriteStage = buffer[15];
+  tms9918->currentAddress = (uint16_t)(buffer[16] | (buffer[17] << 8));
+  tms9918->timing = timing;
+  tmsRefreshDecoded(tms9918);
+  tms9918->beamLine = beamLine;
+  tms9918->beamClock = beamClock;
+  tmsClearChangeLog(tms9918);
+
+  if (compressed)
+  {
+    tmsRleDecode(vram, vramBytes, tms9918->vram, VRAM_SIZE);
+  }
+  else
+  {
+    memcpy(tms9918->vram, vram, VRAM_SIZE);
+  }
+
+  /* everything may have changed */
+  memset(tms9918->vramDirty, 0xff, sizeof(tms9918->vramDirty));
+  memset(tms9918->tileCacheValid, 0, sizeof(tms9918->tileCacheValid));
+  memset(tms9918->spriteCacheValid, 0, sizeof(tms9918->spriteCacheValid));
+  tms9918->vramPagesWritten = ~0ull;
+  tms9918->lastFrameValid = false;
+
+  return true;
+}
+
+/* Function:  vrEmuTms9918EnableRewind
+ * ----------------------------------------
+ * enable (or disable) the rewind history, dropping any existing history
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918EnableRewind(VrEmuTms9918* tms9918, unsigned numFrames, size_t maxPageBytes)
+{
+  if (tms9918 == NULL)
+    return false;
+
+  if (tms9918->rewindHistory)
+  {
+    free(tms9918->rewindHistory->frames);
+    free(tms9918->rewindHistory->pages);
+    free(tms9918->rewindHistory);
+    tms9918->rewindHistory = NULL;
+  }
+
+  if (numFrames == 0)
+    return true;
+
+  /* room for at least one snapshot of every page */
+  size_t numPages = maxPageBytes / VRAM_PAGE_BYTES;
+  if (numPages < VRAM_PAGES) numPages = VRAM_PAGES;
+
+  vrEmuTms9918RewindHistory* history = (vrEmuTms9918RewindHistory*)malloc(sizeof(vrEmuTms9918RewindHistory));
+  if (history == NULL)
+    return false;
+
+  history->frames = (vrEmuTms9918RewindFrame*)malloc(numFrames * sizeof(vrEmuTms9918RewindFrame));
+  history->pages = malloc(numPages * sizeof(*history->pages));
+  if (history->frames == NULL || history->pages == NULL)
+  {
+    free(history->frames);
+    free(history->pages);
+    free(history);
+    return false;
+  }
+
+  history->numFrames = numFrames;
+  history->firstFrame = 0;
+  history->frameCount = 0;
+  history->numPages = numPages;
+  history->firstPage = 0;
+  history->pageCount = 0;
+  memcpy(history->vram, tms9918->vram, VRAM_SIZE);
+
+  tms9918->vramPagesWritten = 0;
+  tms9918->rewindHistory = history;
+  return true;
+}
+
+/* Function:  vrEmuTms9918RewindSnapshot
+ * ----------------------------------------
+ * add a snapshot to the rewind history
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918RewindSnapshot(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL || tms9918->rewindHistory == NULL)
+    return false;
+
+  vrEmuTms9918RewindHistory* history = tms9918->rewindHistory;
+
+  /* pages actually different from the last snapshot */
+  uint64_t pages = 0;
+  uint8_t numPages = 0;
+  for (int page = 0; page < VRAM_PAGES; ++page)
+  {
+    const size_t offset = (size_t)page * VRAM_PAGE_BYTES;
+    if ((tms9918->vramPagesWritten >> page) & 1 &&
+        memcmp(history->vram + offset, tms9918->vram + offset, VRAM_PAGE_BYTES) != 0)
+    {
+      pages |= 1ull << page;
+      ++numPages;
+    }
+  }
+  tms9918->vramPagesWritten = 0;
+
+  /* drop the oldest snapshots to make room */
+  while (history->frameCount == history->numFrames || history->pageCount + numPages > history->numPages)
+  {
+    const vrEmuTms9918RewindFrame* oldest = &history->frames[history->firstFrame];
+    history->firstPage = (history->firstPage + oldest->numPages) % history->numPages;
+    history->pageCount -= oldest->numPages;
+    history->firstFrame = (history->firstFrame + 1) % history->numFrames;
+    --history->frameCount;
+  }
+
+  vrEmuTms9918RewindFrame* frame = &history->frames[(history->firstFrame + history->frameCount) % history->numFrames];
+  memcpy(frame->registers, tms9918->registers, TMS_NUM_REGISTERS);
+  frame->status = vrEmuTms9918StatusValue(tms9918);
+  frame->regWriteStage = tms9918->regWriteStage;
+  frame->currentAddress = tms9918->currentAddress;
+  frame->beamLine = tms9918->beamLine;
+  frame->beamClock = tms9918->beamClock;
+  frame->pages = pages;
+  frame->numPages = numPages;
+  frame->firstPage = (history->firstPage + history->pageCount) % history->numPages;
+
+  size_t slot = frame->firstPage;
+  for (int page = 0; page < VRAM_PAGES; ++page)
+  {
+    if ((pages >> page) & 1)
+    {
+      const size_t offset = (size_t)page * VRAM_PAGE_BYTES;
+      memcpy(history->pages[slot], history->vram + offset, VRAM_PAGE_BYTES);
+      memcpy(history->vram + offset, tms9918->vram + offset, VRAM_PAGE_BYTES);
+      slot = (slot + 1) % history->numPages;
+    }
+  }
+
+  history->pageCount += numPages;
+  ++history->frameCount;
+  return true;
+}
+
+/* Function:  vrEmuTms9918RewindFrames
+ * ----------------------------------------
+ * number of snapshots in the rewind history
+ */
+VR_EMU_TMS9918_DLLEXPORT
+unsigned vrEmuTms9918RewindFrames(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL || tms9918->rewindHistory == NULL)
+    return 0;
+
+  return (unsigned)tms9918->rewindHistory->frameCount;
+}
+
+/* Function:  vrEmuTms9918Rewind
+ * ----------------------------------------
+ * restore a snapshot from the rewind history, discarding newer snapshots
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918Rewind(VrEmuTms9918* tms9918, unsigned frames)
+{
+  if (tms9918 == NULL || tms9918->rewindHistory == NULL || frames >= tms9918->rewindHistory->frameCount)
+    return false;
+
+  vrEmuTms9918RewindHistory* history = tms9918->rewindHistory;
+
+  /* undo the newer snapshots' pages, newest first */
+  uint64_t restorePages = tms9918->vramPagesWritten;
+  for (unsigned i = 0; i < frames; ++i)
+  {
+    const vrEmuTms9918RewindFrame* newest = &history->frames[(history->firstFrame + history->frameCount - 1) % history->numFrames];
+
+    size_t slot = newest->firstPage;
+    for (int page = 0; page < VRAM_PAGES; ++page)
+    {
+      if ((newest->pages >> page) & 1)
+      {
+        memcpy(history->vram + (size_t)page * VRAM_PAGE_BYTES, history->pages[slot], VRAM_PAGE_BYTES);
+        slot = (slot + 1) % history->numPages;
+      }
+    }
+    restorePages |= newest->pages;
+    history->pageCount -= newest->numPages;
+    --history->frameCount;
+  }
+
+  const vrEmuTms9918RewindFrame* frame = &history->frames[(history->firstFrame + history->frameCount - 1) % history->numFrames];
+  memcpy(tms9918->registers, frame->registers, TMS_NUM_REGISTERS);
+  tmsRefreshDecoded(tms9918);
+  tms9918->status = frame->status;
+  tms9918->collisionsPending = false;
+  memset(tms9918->collisionLines, 0, sizeof(tms9918->collisionLines));
+  tms9918->regWriteStage = frame->regWriteStage;
+  tms9918->currentAddress = frame->currentAddress;
+  tms9918->beamLine = frame->beamLine;
+  tms9918->beamClock = frame->beamClock;
+  tmsClearChangeLog(tms9918);
+
+  for (int page = 0; page < VRAM_PAGES; ++page)
+  {
+    if ((restorePages >> page) & 1)
+    {
+      const size_t offset = (size_t)page * VRAM_PAGE_BYTES;
+      memcpy(tms9918->vram + offset, history->vram + offset, VRAM_PAGE_BYTES);
+      memset(tms9918->vramDirty + offset / DIRTY_WORD_BITS, 0xff, VRAM_PAGE_BYTES / DIRTY_WORD_BITS * sizeof(uint64_t));
+    }
+  }
+  if (restorePages)
+  {
+    memset(tms9918->tileCacheValid, 0, sizeof(tms9918->tileCacheValid));
+    memset(tms9918->spriteCacheValid, 0, sizeof(tms9918->spriteCacheValid));
+  }
+  tms9918->vramPagesWritten = 0;
+
+  return true;
+}
+
+/* Function:  vrEmuTms9918EnableLazyCollisions
+ * ----------------------------------------
+ * defer sprite collision tests until the status register is needed
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918EnableLazyCollisions(VrEmuTms9918* tms9918, bool enable)
+{
+  if (tms9918 == NULL)
+    return;
+
+  if (tms9918->collisionsPending)
+  {
+    tmsResolveCollisions(tms9918);
+  }
+  tms9918->lazyCollisions = enable;
+  tmsRefreshDecoded(tms9918);
+}
+
+/* Function:  vrEmuTms9918StatusValue
+ * ----------------------------------------
+ * return the status register value (without clearing it)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+uint8_t vrEmuTms9918StatusValue(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL)
+    return 0;
+
+  if (tms9918->collisionsPending)
+  {
+    tmsResolveCollisions(tms9918);
+  }
+
+  return tms9918->status;
+}
+
+/* Function:  vrEmuTms9918InterruptPending
+ * ----------------------------------------
+ * is the INT status bit set with interrupts enabled?
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918InterruptPending(VrEmuTms9918* tms9918)
+{
+  if (tms9918 == NULL)
+    return false;
+
+  return (tms9918->status & STATUS_INT) && (tms9918->registers[TMS_REG_1] & TMS_R1_INT_ENABLE);
 }
 
 /* Function:  vrEmuTms9918RegValue
@@ -680,8 +3913,7 @@ void vrEmuTms9918WriteRegValue(VrEmuTms9918* tms9918, vrEmuTms9918Register reg,
 {
   if (tms9918 != NULL)
   {
-    tms9918->registers[reg & 0x07] = value;
-    tms9918->mode = tmsMode(tms9918);
+    tmsSetRegister(tms9918, (uint8_t)reg, value);
   }
 }
 
@@ -37,6 +37,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* PRIVATE DATA STRUCTURE
  * ---------------------------------------- */
@@ -90,8 +91,52 @@ typedef enum
   TMS_REG_FG_BG_COLOR       = TMS_REG_7,
 } vrEmuTms9918Register;
 
+typedef enum
+{
+  TMS_PIXEL_FORMAT_INDEX,     /* 8-bit palette index (vrEmuTms9918Color) */
+  TMS_PIXEL_FORMAT_RGBA8888,  /* 32-bit packed 0xRRGGBBAA (native endian) */
+  TMS_PIXEL_FORMAT_BGRA8888,  /* 32-bit packed 0xBBGGRRAA (native endian) */
+  TMS_PIXEL_FORMAT_RGB24,     /* 24-bit, bytes R, G, B */
+  TMS_PIXEL_FORMAT_RGB565,    /* 16-bit packed RRRRRGGGGGGBBBBB (native endian) */
+  TMS_PIXEL_FORMAT_RGBA32,    /* 32-bit, bytes R, G, B, A (any endian) */
+} vrEmuTms9918PixelFormat;
+
+typedef enum
+{
+  TMS_TIMING_HOST,  /* status updated by the scanline / frame renderers (default) */
+  TMS_TIMING_NTSC,  /* status updated by vrEmuTms9918Clock(), 262 lines per frame */
+  TMS_TIMING_PAL,   /* status updated by vrEmuTms9918Clock(), 313 lines per frame */
+} vrEmuTms9918Timing;
+
 #define TMS9918_PIXELS_X 256
 #define TMS9918_PIXELS_Y 192
+#define TMS9918_NUM_COLORS 16
+#define TMS9918_BATCH_LANES 16
+
+#define TMS9918_CLOCKS_PER_LINE 342
+#define TMS9918_LINES_NTSC 262
+#define TMS9918_LINES_PAL 313
+
+/* port operation for vrEmuTms9918PortOps()
+ * bits 0-7: data (DB0 -> DB7) for writes
+ * bit 8:    mode (0 = data, 1 = address / status)
+ * bit 9:    direction (0 = write, 1 = read) */
+typedef uint16_t vrEmuTms9918PortOp;
+
+#define TMS_PORT_OP_DATA_MASK   0x00ff
+#define TMS_PORT_OP_MODE        0x0100
+#define TMS_PORT_OP_READ        0x0200
+
+#define TMS_PORT_OP_WRITE_DATA  0
+#define TMS_PORT_OP_WRITE_ADDR  TMS_PORT_OP_MODE
+#define TMS_PORT_OP_READ_DATA   TMS_PORT_OP_READ
+#define TMS_PORT_OP_READ_STATUS (TMS_PORT_OP_READ | TMS_PORT_OP_MODE)
+
+#define TMS_PORT_WRITE_DATA(d)  ((vrEmuTms9918PortOp)(TMS_PORT_OP_WRITE_DATA | (uint8_t)(d)))
+#define TMS_PORT_WRITE_ADDR(d)  ((vrEmuTms9918PortOp)(TMS_PORT_OP_WRITE_ADDR | (uint8_t)(d)))
+
+/* save state blob version written by vrEmuTms9918SaveState() */
+#define TMS9918_STATE_VERSION 1
 
 
 /* PUBLIC INTERFACE
@@ -138,6 +183,17 @@ void vrEmuTms9918WriteAddr(VrEmuTms9918* tms9918, uint8_t data);
 VR_EMU_TMS9918_DLLEXPORT
 void vrEmuTms9918WriteData(VrEmuTms9918* tms9918, uint8_t data);
 
+/* Function:  vrEmuTms9918WriteBlock
+ * --------------------
+ * write a block of data (mode = 0) to the tms9918
+ * same result as calling vrEmuTms9918WriteData() for each byte
+ *
+ * bytes: the data to send
+ * numBytes: number of bytes to send
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918WriteBlock(VrEmuTms9918* tms9918, const uint8_t* bytes, size_t numBytes);
+
 /* Function:  vrEmuTms9918ReadStatus
  * --------------------
  * read from the status register
@@ -152,6 +208,17 @@ uint8_t vrEmuTms9918ReadStatus(VrEmuTms9918* tms9918);
 VR_EMU_TMS9918_DLLEXPORT
 uint8_t vrEmuTms9918ReadData(VrEmuTms9918* tms9918);
 
+/* Function:  vrEmuTms9918ReadBlock
+ * --------------------
+ * read a block of data (mode = 0) from the tms9918
+ * same result as calling vrEmuTms9918ReadData() for each byte
+ *
+ * bytes: buffer to receive the data
+ * numBytes: number of bytes to read
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918ReadBlock(VrEmuTms9918* tms9918, uint8_t* bytes, size_t numBytes);
+
 /* Function:  vrEmuTms9918ReadDataNoInc
  * --------------------
  * read data (mode = 0) from the tms9918
@@ -160,6 +227,55 @@ uint8_t vrEmuTms9918ReadData(VrEmuTms9918* tms9918);
 VR_EMU_TMS9918_DLLEXPORT
 uint8_t vrEmuTms9918ReadDataNoInc(VrEmuTms9918* tms9918);
 
+/* Function:  vrEmuTms9918PortOps
+ * --------------------
+ * execute a sequence of port operations in a single call
+ * same result as calling the individual port functions in order
+ *
+ * ops: encoded operations (TMS_PORT_WRITE_DATA(d), TMS_PORT_WRITE_ADDR(d),
+ *      TMS_PORT_OP_READ_DATA, TMS_PORT_OP_READ_STATUS)
+ * numOps: number of operations
+ * results: receives the value of each read operation, in order (may be NULL)
+ *
+ * returns the number of read operations performed
+ */
+VR_EMU_TMS9918_DLLEXPORT
+size_t vrEmuTms9918PortOps(VrEmuTms9918* tms9918, const vrEmuTms9918PortOp* ops, size_t numOps, uint8_t* results);
+
+/* Function:  vrEmuTms9918SetTiming
+ * --------------------
+ * select how the status register is driven
+ *
+ * TMS_TIMING_HOST: the renderers update the status register (default)
+ * TMS_TIMING_NTSC / TMS_TIMING_PAL: vrEmuTms9918Clock() tracks the beam
+ *   and updates the status register. the renderers only produce pixels
+ *
+ * the beam is moved to the start of the first active line
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918SetTiming(VrEmuTms9918* tms9918, vrEmuTms9918Timing timing);
+
+/* Function:  vrEmuTms9918Clock
+ * --------------------
+ * advance the beam (TMS_TIMING_NTSC / TMS_TIMING_PAL only)
+ *
+ * cycles: pixel clocks to advance (TMS9918_CLOCKS_PER_LINE per line)
+ *
+ * sprite status is evaluated as each active line completes and
+ * the INT status bit is set at the end of the last active line
+ *
+ * returns true while the interrupt output is asserted
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918Clock(VrEmuTms9918* tms9918, uint32_t cycles);
+
+/* Function:  vrEmuTms9918BeamLine
+ * --------------------
+ * current beam line (0 - 191 active, then border / blanking lines)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+uint16_t vrEmuTms9918BeamLine(VrEmuTms9918* tms9918);
+
 
 /* Function:  vrEmuTms9918ScanLine
  * ----------------------------------------
@@ -170,6 +286,251 @@ uint8_t vrEmuTms9918ReadDataNoInc(VrEmuTms9918* tms9918);
 VR_EMU_TMS9918_DLLEXPORT
 void vrEmuTms9918ScanLine(VrEmuTms9918* tms9918, uint8_t y, uint8_t pixels[TMS9918_PIXELS_X]);
 
+/* Function:  vrEmuTms9918RenderFrame
+ * ----------------------------------------
+ * generate all TMS9918_PIXELS_Y scanlines of a frame
+ *
+ * pixels to be filled with TMS9918 color palette indexes (vrEmuTms9918Color)
+ * pitch: number of bytes between the start of each line in pixels
+ *
+ * the status register is updated as if vrEmuTms9918ScanLine() was
+ * called for each line in turn
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918RenderFrame(VrEmuTms9918* tms9918, uint8_t* pixels, size_t pitch);
+
+/* Function:  vrEmuTms9918ScanLineFormat
+ * ----------------------------------------
+ * generate a scanline in the given pixel format
+ *
+ * pixels to be filled with TMS9918_PIXELS_X pixels converted through
+ * the palette set with vrEmuTms9918SetPalette()
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918ScanLineFormat(VrEmuTms9918* tms9918, uint8_t y, void* pixels, vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918RenderFrameFormat
+ * ----------------------------------------
+ * generate all TMS9918_PIXELS_Y scanlines of a frame in the given pixel format
+ *
+ * pitch: number of bytes between the start of each line in pixels
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918RenderFrameFormat(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918RenderFrameUpdate
+ * ----------------------------------------
+ * generate a frame in the given pixel format, re-rendering only the
+ * scanlines affected by register and vram changes since the last call
+ *
+ * pixels must still hold the output of the previous call (same buffer,
+ * pitch and format), otherwise the whole frame is rendered. the status
+ * register is updated as vrEmuTms9918RenderFrameFormat() would
+ *
+ * returns the number of scanlines rendered
+ */
+VR_EMU_TMS9918_DLLEXPORT
+int vrEmuTms9918RenderFrameUpdate(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918RenderLines
+ * --------------------
+ * generate scanlines firstLine to firstLine + numLines - 1 of a frame.
+ * pixel output only: the status register is not updated
+ *
+ * the instance isn't modified, so several threads may render disjoint
+ * ranges of the same frame at once. the current vram and registers are
+ * rendered: with clocked timing, changes logged during the frame are
+ * ignored. vrEmuTms9918RenderFrameRanges() handles them, and the
+ * status, for a whole frame
+ *
+ * pixels: the frame (row y at pixels + y * pitch)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918RenderLines(VrEmuTms9918* tms9918, uint8_t firstLine, uint8_t numLines, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918ScanLineStatus
+ * --------------------
+ * update the status register (5S, sprite index, COL and INT) exactly as
+ * vrEmuTms9918ScanLine() would, without any output. for skipped frames
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918ScanLineStatus(VrEmuTms9918* tms9918, uint8_t y);
+
+/* Function:  vrEmuTms9918FrameStatus
+ * --------------------
+ * update the status register (5S, sprite index, COL and INT) exactly as
+ * rendering a whole frame would, in scanline order, without any output
+ *
+ * returns the new status value (not cleared)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+uint8_t vrEmuTms9918FrameStatus(VrEmuTms9918* tms9918);
+
+/* render one range of scanlines of a frame (see vrEmuTms9918RenderFrameRanges) */
+typedef void (*vrEmuTms9918RangeFn)(void* frame, unsigned range);
+
+/* call render(frame, range) once for each range from 0 to numRanges - 1,
+   in any order and on any threads, and return once all are done */
+typedef void (*vrEmuTms9918ParallelFn)(void* context, unsigned numRanges, vrEmuTms9918RangeFn render, void* frame);
+
+/* Function:  vrEmuTms9918RenderFrameRanges
+ * --------------------
+ * generate a frame split into numRanges ranges of scanlines, rendered
+ * through parallel (e.g. on a thread pool). same result, including the
+ * status register, as vrEmuTms9918RenderFrameFormat()
+ *
+ * with clocked timing, changes made after the last active line are
+ * undone while the ranges render. frames with changes part way through
+ * are replayed on the calling thread instead
+ *
+ * the status is updated once all ranges are done, in scanline order
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918RenderFrameRanges(VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format,
+                                   unsigned numRanges, vrEmuTms9918ParallelFn parallel, void* context);
+
+/* Function:  vrEmuTms9918RenderFrameBatch
+ * --------------------
+ * generate a frame for each of a group of instances. same result as
+ * calling vrEmuTms9918RenderFrameFormat() for each
+ *
+ * Graphics I/II instances are rendered TMS9918_BATCH_LANES at a time,
+ * one scanline across all of them per pass. other instances are
+ * rendered one at a time
+ *
+ * instances: the instances to render (each at most once)
+ * pixels: frame output for each instance
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918RenderFrameBatch(VrEmuTms9918* const* instances, size_t numInstances, void* const* pixels, size_t pitch, vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918SetPalette
+ * ----------------------------------------
+ * set the palette used by the formatted renderers
+ *
+ * palette: TMS9918_NUM_COLORS RGBA (0xRRGGBBAA) values indexed by
+ *          vrEmuTms9918Color. NULL restores the default palette
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918SetPalette(VrEmuTms9918* tms9918, const uint32_t palette[TMS9918_NUM_COLORS]);
+
+/* Function:  vrEmuTms9918PixelFormatBytes
+ * ----------------------------------------
+ * return the number of bytes per pixel for a pixel format
+ */
+VR_EMU_TMS9918_DLLEXPORT
+uint8_t vrEmuTms9918PixelFormatBytes(vrEmuTms9918PixelFormat format);
+
+/* Function:  vrEmuTms9918EnableTileCache
+ * ----------------------------------------
+ * enable or disable a cache of decoded Graphics I/II tile rows (48KB)
+ *
+ * cached tiles are invalidated by writes to the pattern and color tables
+ * and by changes to the table addresses, mode or backdrop color
+ *
+ * returns false if the cache could not be allocated
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918EnableTileCache(VrEmuTms9918* tms9918, bool enable);
+
+/* Function:  vrEmuTms9918EnableLazyCollisions
+ * ----------------------------------------
+ * enable (default) or disable deferred sprite collision tests
+ *
+ * when enabled, the renderers only record which lines need testing. the
+ * COL bit is worked out when the status is read (or sprite vram or a
+ * register is about to change), with the same result. clocked timing
+ * (vrEmuTms9918SetTiming()) always tests each line as the beam passes it
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918EnableLazyCollisions(VrEmuTms9918* tms9918, bool enable);
+
+/* Function:  vrEmuTms9918SaveStateSize
+ * ----------------------------------------
+ * return the size of the blob vrEmuTms9918SaveState() would write now
+ *
+ * compress: run-length encode vram
+ */
+VR_EMU_TMS9918_DLLEXPORT
+size_t vrEmuTms9918SaveStateSize(VrEmuTms9918* tms9918, bool compress);
+
+/* Function:  vrEmuTms9918SaveState
+ * ----------------------------------------
+ * save registers, status, address, write stage, beam timing and vram
+ * to a versioned blob
+ *
+ * compress: run-length encode vram (best for mostly empty or filled vram)
+ *
+ * returns the number of bytes written or 0 if the buffer is too small
+ */
+VR_EMU_TMS9918_DLLEXPORT
+size_t vrEmuTms9918SaveState(VrEmuTms9918* tms9918, uint8_t* buffer, size_t bufferSize, bool compress);
+
+/* Function:  vrEmuTms9918LoadState
+ * ----------------------------------------
+ * restore a blob written by vrEmuTms9918SaveState()
+ *
+ * returns false (leaving the tms9918 unchanged) if the blob is invalid
+ * or from an unsupported version
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918LoadState(VrEmuTms9918* tms9918, const uint8_t* buffer, size_t bufferSize);
+
+/* Function:  vrEmuTms9918EnableRewind
+ * ----------------------------------------
+ * enable or disable a rewind history of recent snapshots
+ *
+ * numFrames:    snapshots to keep (0 disables the history)
+ * maxPageBytes: memory for saved vram (at least 16KB). each snapshot keeps
+ *               only the 256 byte vram pages changed since the one before
+ *
+ * any existing history is dropped. returns false if it could not be allocated
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918EnableRewind(VrEmuTms9918* tms9918, unsigned numFrames, size_t maxPageBytes);
+
+/* Function:  vrEmuTms9918RewindSnapshot
+ * ----------------------------------------
+ * add a snapshot (registers, status, address, beam and vram) to the rewind
+ * history, dropping the oldest snapshots if full. call once per frame
+ *
+ * returns false if rewind is not enabled
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918RewindSnapshot(VrEmuTms9918* tms9918);
+
+/* Function:  vrEmuTms9918RewindFrames
+ * ----------------------------------------
+ * number of snapshots in the rewind history
+ */
+VR_EMU_TMS9918_DLLEXPORT
+unsigned vrEmuTms9918RewindFrames(VrEmuTms9918* tms9918);
+
+/* Function:  vrEmuTms9918Rewind
+ * ----------------------------------------
+ * restore the snapshot taken frames snapshots before the latest (0 = the
+ * latest). the newer snapshots are discarded
+ *
+ * returns false if there is no such snapshot
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918Rewind(VrEmuTms9918* tms9918, unsigned frames);
+
+/* Function:  vrEmuTms9918StatusValue
+ * ----------------------------------------
+ * return the status register value
+ * unlike vrEmuTms9918ReadStatus(), the status is not cleared
+ */
+VR_EMU_TMS9918_DLLEXPORT
+uint8_t vrEmuTms9918StatusValue(VrEmuTms9918* tms9918);
+
+/* Function:  vrEmuTms9918InterruptPending
+ * ----------------------------------------
+ * is the INT status bit set with interrupts enabled?
+ */
+VR_EMU_TMS9918_DLLEXPORT
+bool vrEmuTms9918InterruptPending(VrEmuTms9918* tms9918);
+
 /* Function:  vrEmuTms9918RegValue
  * ----------------------------------------
  * return a reigister value
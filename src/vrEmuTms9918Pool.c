@@ -0,0 +1,466 @@
+/*
+ * Troy's TMS9918 Emulator - Multi-instance render pool
+ *
+ * Copyright (c) 2022 Troy Schrapel
+ *
+ * This code is licensed under the MIT license
+ *
+ * https://github.com/visrealm/vrEmuTms9918
+ *
+ */
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "vrEmuTms9918Pool.h"
+
+#include <stdlib.h>
+
+/* threading primitives
+ * ---------------------------------------- */
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+
+  typedef CRITICAL_SECTION tmsMutex;
+  typedef CONDITION_VARIABLE tmsCond;
+  typedef HANDLE tmsThread;
+
+  #define tmsMutexInit(m)       InitializeCriticalSection(m)
+  #define tmsMutexDestroy(m)    DeleteCriticalSection(m)
+  #define tmsMutexLock(m)       EnterCriticalSection(m)
+  #define tmsMutexUnlock(m)     LeaveCriticalSection(m)
+  #define tmsCondInit(c)        InitializeConditionVariable(c)
+  #define tmsCondDestroy(c)
+  #define tmsCondWait(c, m)     SleepConditionVariableCS(c, m, INFINITE)
+  #define tmsCondBroadcast(c)   WakeAllConditionVariable(c)
+  #define TMS_THREAD_PROC       DWORD WINAPI
+  #define TMS_THREAD_RETURN     0
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+
+  typedef pthread_mutex_t tmsMutex;
+  typedef pthread_cond_t tmsCond;
+  typedef pthread_t tmsThread;
+
+  #define tmsMutexInit(m)       pthread_mutex_init(m, NULL)
+  #define tmsMutexDestroy(m)    pthread_mutex_destroy(m)
+  #define tmsMutexLock(m)       pthread_mutex_lock(m)
+  #define tmsMutexUnlock(m)     pthread_mutex_unlock(m)
+  #define tmsCondInit(c)        pthread_cond_init(c, NULL)
+  #define tmsCondDestroy(c)     pthread_cond_destroy(c)
+  #define tmsCondWait(c, m)     pthread_cond_wait(c, m)
+  #define tmsCondBroadcast(c)   pthread_cond_broadcast(c)
+  #define TMS_THREAD_PROC       void*
+  #define TMS_THREAD_RETURN     NULL
+#endif
+
+/* a thread's share of the current batch */
+typedef struct
+{
+  tmsMutex lock;
+  size_t begin;     /* next job to take from the front */
+  size_t end;       /* one past the last job (thieves take from here) */
+} vrEmuTms9918PoolQueue;
+
+/* ranges of scanlines per thread when one frame is split across the pool */
+#define POOL_RANGES_PER_THREAD 4
+
+struct vrEmuTms9918Pool_s;
+
+typedef struct
+{
+  struct vrEmuTms9918Pool_s* pool;
+  unsigned index;
+} vrEmuTms9918PoolWorker;
+
+struct vrEmuTms9918Pool_s
+{
+  /* threads rendering each batch (worker 0 is the calling thread) */
+  unsigned numWorkers;
+  unsigned numQueues;    /* queues initialized (workers that failed to start still have one) */
+  tmsThread* threads;
+  vrEmuTms9918PoolWorker* workers;
+  vrEmuTms9918PoolQueue* queues;
+
+  /* batch hand-off */
+  tmsMutex lock;
+  tmsCond start;
+  tmsCond done;
+  unsigned generation;   /* incremented for each batch */
+  unsigned active;       /* worker threads still on the current batch */
+  bool quit;
+
+  /* current batch: frames to render, or else ranges of one frame */
+  vrEmuTms9918PoolJob* jobs;
+  vrEmuTms9918RangeFn renderRange;
+  void* frame;
+};
+
+
+/* Function:  tmsCpuCount
+ * ----------------------------------------
+ * number of online cpus
+ */
+static unsigned tmsCpuCount(void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (unsigned)count : 1;
+#else
+  return 1;
+#endif
+}
+
+/* Function:  tmsPoolRenderJob
+ * ----------------------------------------
+ * render a single job
+ */
+static void tmsPoolRenderJob(vrEmuTms9918PoolJob* job)
+{
+  if (job->prepare)
+  {
+    job->prepare(job->tms9918, job->context);
+  }
+
+  vrEmuTms9918RenderFrameFormat(job->tms9918, job->pixels, job->pitch, job->format);
+
+  job->status = vrEmuTms9918StatusValue(job->tms9918);
+  job->interrupt = vrEmuTms9918InterruptPending(job->tms9918);
+}
+
+/* Function:  tmsPoolTakeJob
+ * ----------------------------------------
+ * take the next job from the front of a worker's own queue
+ */
+static bool tmsPoolTakeJob(vrEmuTms9918PoolQueue* queue, size_t* job)
+{
+  bool taken = false;
+
+  tmsMutexLock(&queue->lock);
+  if (queue->begin < queue->end)
+  {
+    *job = queue->begin++;
+    taken = true;
+  }
+  tmsMutexUnlock(&queue->lock);
+
+  return taken;
+}
+
+/* Function:  tmsPoolSteal
+ * ----------------------------------------
+ * move half of another worker's remaining jobs to this worker's queue
+ */
+static bool tmsPoolSteal(VrEmuTms9918Pool* pool, unsigned index)
+{
+  for (unsigned i = 1; i < pool->numWorkers; ++i)
+  {
+    vrEmuTms9918PoolQueue* victim = &pool->queues[(index + i) % pool->numWorkers];
+    size_t begin = 0, end = 0;
+
+    tmsMutexLock(&victim->lock);
+    if (victim->begin < victim->end)
+    {
+      const size_t remaining = victim->end - victim->begin;
+      end = victim->end;
+      begin = end - (remaining + 1) / 2;
+      victim->end = begin;
+    }
+    tmsMutexUnlock(&victim->lock);
+
+    if (begin < end)
+    {
+      vrEmuTms9918PoolQueue* queue = &pool->queues[index];
+
+      tmsMutexLock(&queue->lock);
+      queue->begin = begin;
+      queue->end = end;
+      tmsMutexUnlock(&queue->lock);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Function:  tmsPoolWork
+ * ----------------------------------------
+ * render jobs (or ranges) until no worker has any left
+ */
+static void tmsPoolWork(VrEmuTms9918Pool* pool, unsigned index)
+{
+  vrEmuTms9918PoolQueue* queue = &pool->queues[index];
+
+  for (;;)
+  {
+    size_t job;
+    while (tmsPoolTakeJob(queue, &job))
+    {
+      if (pool->jobs)
+      {
+        tmsPoolRenderJob(&pool->jobs[job]);
+      }
+      else
+      {
+        pool->renderRange(pool->frame, (unsigned)job);
+      }
+    }
+
+    if (!tmsPoolSteal(pool, index))
+      break;
+  }
+}
+
+/* Function:  tmsPoolThread
+ * ----------------------------------------
+ * worker thread: wait for a batch, work on it, repeat
+ */
+static TMS_THREAD_PROC tmsPoolThread(void* param)
+{
+  vrEmuTms9918PoolWorker* worker = (vrEmuTms9918PoolWorker*)param;
+  VrEmuTms9918Pool* pool = worker->pool;
+  unsigned generation = 0;
+
+  for (;;)
+  {
+    tmsMutexLock(&pool->lock);
+    while (!pool->quit && pool->generation == generation)
+    {
+      tmsCondWait(&pool->start, &pool->lock);
+    }
+    generation = pool->generation;
+    const bool quit = pool->quit;
+    tmsMutexUnlock(&pool->lock);
+
+    if (quit)
+      break;
+
+    tmsPoolWork(pool, worker->index);
+
+    tmsMutexLock(&pool->lock);
+    if (--pool->active == 0)
+    {
+      tmsCondBroadcast(&pool->done);
+    }
+    tmsMutexUnlock(&pool->lock);
+  }
+
+  return TMS_THREAD_RETURN;
+}
+
+/* Function:  tmsPoolStartThread
+ * ----------------------------------------
+ * start a worker thread
+ */
+static bool tmsPoolStartThread(tmsThread* thread, vrEmuTms9918PoolWorker* worker)
+{
+#ifdef _WIN32
+  *thread = CreateThread(NULL, 0, tmsPoolThread, worker, 0, NULL);
+  return *thread != NULL;
+#else
+  return pthread_create(thread, NULL, tmsPoolThread, worker) == 0;
+#endif
+}
+
+/* Function:  tmsPoolJoinThread
+ * ----------------------------------------
+ * wait for a worker thread to finish
+ */
+static void tmsPoolJoinThread(tmsThread thread)
+{
+#ifdef _WIN32
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+/* Function:  vrEmuTms9918PoolNew
+ * ----------------------------------------
+ * create a render pool
+ */
+VR_EMU_TMS9918_DLLEXPORT VrEmuTms9918Pool* vrEmuTms9918PoolNew(unsigned numThreads)
+{
+  VrEmuTms9918Pool* pool = (VrEmuTms9918Pool*)malloc(sizeof(VrEmuTms9918Pool));
+  if (pool == NULL)
+    return NULL;
+
+  if (numThreads == 0)
+  {
+    numThreads = tmsCpuCount();
+  }
+
+  pool->threads = (tmsThread*)malloc(sizeof(tmsThread) * numThreads);
+  pool->workers = (vrEmuTms9918PoolWorker*)malloc(sizeof(vrEmuTms9918PoolWorker) * numThreads);
+  pool->queues = (vrEmuTms9918PoolQueue*)malloc(sizeof(vrEmuTms9918PoolQueue) * numThreads);
+
+  if (pool->threads == NULL || pool->workers == NULL || pool->queues == NULL)
+  {
+    free(pool->threads);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+
+  tmsMutexInit(&pool->lock);
+  tmsCondInit(&pool->start);
+  tmsCondInit(&pool->done);
+  pool->generation = 0;
+  pool->active = 0;
+  pool->quit = false;
+  pool->jobs = NULL;
+  pool->renderRange = NULL;
+  pool->frame = NULL;
+
+  for (unsigned i = 0; i < numThreads; ++i)
+  {
+    tmsMutexInit(&pool->queues[i].lock);
+    pool->queues[i].begin = pool->queues[i].end = 0;
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+  }
+  pool->numQueues = numThreads;
+
+  /* worker 0 is whichever thread calls vrEmuTms9918PoolRenderFrames().
+     if a thread can't be started, carry on with fewer */
+  pool->numWorkers = 1;
+  for (unsigned i = 1; i < numThreads; ++i)
+  {
+    if (!tmsPoolStartThread(&pool->threads[i], &pool->workers[i]))
+      break;
+    ++pool->numWorkers;
+  }
+
+  return pool;
+}
+
+/* Function:  vrEmuTms9918PoolDestroy
+ * ----------------------------------------
+ * destroy a render pool
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918PoolDestroy(VrEmuTms9918Pool* pool)
+{
+  if (pool == NULL)
+    return;
+
+  tmsMutexLock(&pool->lock);
+  pool->quit = true;
+  tmsCondBroadcast(&pool->start);
+  tmsMutexUnlock(&pool->lock);
+
+  for (unsigned i = 1; i < pool->numWorkers; ++i)
+  {
+    tmsPoolJoinThread(pool->threads[i]);
+  }
+
+  for (unsigned i = 0; i < pool->numQueues; ++i)
+  {
+    tmsMutexDestroy(&pool->queues[i].lock);
+  }
+
+  tmsCondDestroy(&pool->done);
+  tmsCondDestroy(&pool->start);
+  tmsMutexDestroy(&pool->lock);
+
+  free(pool->threads);
+  free(pool->workers);
+  free(pool->queues);
+  free(pool);
+}
+
+/* Function:  vrEmuTms9918PoolThreads
+ * ----------------------------------------
+ * number of threads rendering each batch
+ */
+VR_EMU_TMS9918_DLLEXPORT unsigned vrEmuTms9918PoolThreads(VrEmuTms9918Pool* pool)
+{
+  if (pool == NULL)
+    return 0;
+
+  return pool->numWorkers;
+}
+
+/* Function:  tmsPoolRun
+ * ----------------------------------------
+ * run the current batch of numItems jobs (or ranges) on all workers
+ */
+static void tmsPoolRun(VrEmuTms9918Pool* pool, size_t numItems)
+{
+  /* share the items out evenly. stealing evens out the differences in cost */
+  for (unsigned i = 0; i < pool->numWorkers; ++i)
+  {
+    vrEmuTms9918PoolQueue* queue = &pool->queues[i];
+
+    tmsMutexLock(&queue->lock);
+    queue->begin = numItems * i / pool->numWorkers;
+    queue->end = numItems * (i + 1) / pool->numWorkers;
+    tmsMutexUnlock(&queue->lock);
+  }
+
+  tmsMutexLock(&pool->lock);
+  pool->active = pool->numWorkers - 1;
+  ++pool->generation;
+  tmsCondBroadcast(&pool->start);
+  tmsMutexUnlock(&pool->lock);
+
+  tmsPoolWork(pool, 0);
+
+  tmsMutexLock(&pool->lock);
+  while (pool->active)
+  {
+    tmsCondWait(&pool->done, &pool->lock);
+  }
+  tmsMutexUnlock(&pool->lock);
+}
+
+/* Function:  vrEmuTms9918PoolRenderFrames
+ * ----------------------------------------
+ * render a frame for each job
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918PoolRenderFrames(VrEmuTms9918Pool* pool, vrEmuTms9918PoolJob* jobs, size_t numJobs)
+{
+  if (pool == NULL || jobs == NULL || numJobs == 0)
+    return;
+
+  pool->jobs = jobs;
+  tmsPoolRun(pool, numJobs);
+  pool->jobs = NULL;
+}
+
+/* Function:  tmsPoolRunRanges
+ * ----------------------------------------
+ * vrEmuTms9918ParallelFn running the ranges of a frame on a pool
+ */
+static void tmsPoolRunRanges(void* context, unsigned numRanges, vrEmuTms9918RangeFn render, void* frame)
+{
+  VrEmuTms9918Pool* pool = (VrEmuTms9918Pool*)context;
+
+  pool->renderRange = render;
+  pool->frame = frame;
+  tmsPoolRun(pool, numRanges);
+  pool->renderRange = NULL;
+  pool->frame = NULL;
+}
+
+/* Function:  vrEmuTms9918PoolRenderFrame
+ * ----------------------------------------
+ * render one frame split across the pool's threads
+ */
+VR_EMU_TMS9918_DLLEXPORT void vrEmuTms9918PoolRenderFrame(VrEmuTms9918Pool* pool, VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format)
+{
+  if (pool == NULL)
+    return;
+
+  /* a few ranges per thread, so stealing can even out busier areas of the screen */
+  vrEmuTms9918RenderFrameRanges(tms9918, pixels, pitch, format,
+                                pool->numWorkers * POOL_RANGES_PER_THREAD, tmsPoolRunRanges, pool);
+}
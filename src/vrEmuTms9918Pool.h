@@ -0,0 +1,89 @@
+/*
+ * Troy's TMS9918 Emulator - Multi-instance render pool
+ *
+ * Copyright (c) 2022 Troy Schrapel
+ *
+ * This code is licensed under the MIT license
+ *
+ * https://github.com/visrealm/vrEmuTms9918
+ *
+ */
+
+#ifndef _VR_EMU_TMS9918_POOL_H_
+#define _VR_EMU_TMS9918_POOL_H_
+
+#include "vrEmuTms9918.h"
+
+/* PRIVATE DATA STRUCTURE
+ * ---------------------------------------- */
+struct vrEmuTms9918Pool_s;
+typedef struct vrEmuTms9918Pool_s VrEmuTms9918Pool;
+
+/* a frame to render */
+typedef struct
+{
+  VrEmuTms9918* tms9918;           /* instance to render (each instance at most once per batch) */
+  void* pixels;                    /* frame output (TMS9918_PIXELS_Y rows) */
+  size_t pitch;                    /* bytes between rows */
+  vrEmuTms9918PixelFormat format;  /* output pixel format */
+
+  /* optional: called on the rendering thread just before the frame is
+     rendered, e.g. to load the instance (NULL for none) */
+  void (*prepare)(VrEmuTms9918* tms9918, const void* context);
+  const void* context;             /* passed to prepare */
+
+  uint8_t status;                  /* result: status register after the frame (not cleared) */
+  bool interrupt;                  /* result: INT status bit set and interrupts enabled */
+} vrEmuTms9918PoolJob;
+
+
+/* PUBLIC INTERFACE
+ * ---------------------------------------- */
+
+/* Function:  vrEmuTms9918PoolNew
+ * --------------------
+ * create a render pool
+ *
+ * numThreads: threads rendering each batch, including the calling
+ *             thread (0 = one per cpu)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+VrEmuTms9918Pool* vrEmuTms9918PoolNew(unsigned numThreads);
+
+/* Function:  vrEmuTms9918PoolDestroy
+ * --------------------
+ * destroy a render pool (stops its worker threads)
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918PoolDestroy(VrEmuTms9918Pool* pool);
+
+/* Function:  vrEmuTms9918PoolThreads
+ * --------------------
+ * number of threads rendering each batch
+ */
+VR_EMU_TMS9918_DLLEXPORT
+unsigned vrEmuTms9918PoolThreads(VrEmuTms9918Pool* pool);
+
+/* Function:  vrEmuTms9918PoolRenderFrames
+ * --------------------
+ * prepare (if set) and render a frame for each job using
+ * vrEmuTms9918RenderFrameFormat() and fill in each job's results.
+ * returns when all frames are done
+ *
+ * jobs are shared between the threads up front. a thread that runs out
+ * steals half of the remaining jobs of another thread
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918PoolRenderFrames(VrEmuTms9918Pool* pool, vrEmuTms9918PoolJob* jobs, size_t numJobs);
+
+/* Function:  vrEmuTms9918PoolRenderFrame
+ * --------------------
+ * render a single frame with its scanlines split between the threads,
+ * using vrEmuTms9918RenderFrameRanges(). same result, including the
+ * status register, as vrEmuTms9918RenderFrameFormat()
+ */
+VR_EMU_TMS9918_DLLEXPORT
+void vrEmuTms9918PoolRenderFrame(VrEmuTms9918Pool* pool, VrEmuTms9918* tms9918, void* pixels, size_t pitch, vrEmuTms9918PixelFormat format);
+
+
+#endif // _VR_EMU_TMS9918_POOL_H_
@@ -0,0 +1,1045 @@
+/*
+ * Troy's TMS9918 Emulator - Regression tests
+ *
+ * Copyright (c) 2022 Troy Schrapel
+ *
+ * This code is licensed under the MIT license
+ *
+ * https://github.com/visrealm/vrEmuTms9918
+ *
+ */
+
+#include "vrEmuTms9918.h"
+#include "vrEmuTms9918Util.h"
+#include "vrEmuTms9918Pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+/* Function:  writeReg
+ * ----------------------------------------
+ * write a register through the address port
+ */
+static void writeReg(VrEmuTms9918* tms9918, uint8_t reg, uint8_t value)
+{
+  vrEmuTms9918WriteAddr(tms9918, value);
+  vrEmuTms9918WriteAddr(tms9918, 0x80 | reg);
+}
+
+/* Function:  writeVram
+ * ----------------------------------------
+ * write bytes to vram through the data port
+ */
+static void writeVram(VrEmuTms9918* tms9918, uint16_t addr, const uint8_t* bytes, size_t numBytes)
+{
+  vrEmuTms9918WriteAddr(tms9918, (uint8_t)addr);
+  vrEmuTms9918WriteAddr(tms9918, 0x40 | ((addr >> 8) & 0x3f));
+  vrEmuTms9918WriteBlock(tms9918, bytes, numBytes);
+}
+
+/* Function:  clockToLine
+ * ----------------------------------------
+ * advance the beam to the start of a line
+ */
+static void clockToLine(VrEmuTms9918* tms9918, uint16_t line)
+{
+  vrEmuTms9918Clock(tms9918, (line - vrEmuTms9918BeamLine(tms9918)) * TMS9918_CLOCKS_PER_LINE);
+}
+
+/* Function:  newGraphicsI
+ * ----------------------------------------
+ * an NTSC clocked instance showing a blank Graphics I screen (no sprites)
+ * in the backdrop color
+ */
+static VrEmuTms9918* newGraphicsI(uint8_t backdrop)
+{
+  VrEmuTms9918* tms9918 = vrEmuTms9918New();
+  if (tms9918 == NULL)
+    return NULL;
+
+  static const uint8_t zeros[0x4000] = { 0 };
+  writeVram(tms9918, 0x0000, zeros, sizeof(zeros));
+
+  /* no sprites */
+  static const uint8_t lastSprite = 0xd0;
+  writeVram(tms9918, 0x1800, &lastSprite, 1);
+
+  writeReg(tms9918, TMS_REG_0, TMS_R0_MODE_GRAPHICS_I);
+  writeReg(tms9918, TMS_REG_1, TMS_R1_RAM_16K | TMS_R1_DISP_ACTIVE);
+  writeReg(tms9918, TMS_REG_NAME_TABLE, 0x01);             /* 0x0400 */
+  writeReg(tms9918, TMS_REG_COLOR_TABLE, 0x20);            /* 0x0800 */
+  writeReg(tms9918, TMS_REG_PATTERN_TABLE, 0x02);          /* 0x1000 */
+  writeReg(tms9918, TMS_REG_SPRITE_ATTR_TABLE, 0x30);      /* 0x1800 */
+  writeReg(tms9918, TMS_REG_SPRITE_PATT_TABLE, 0x04);      /* 0x2000 */
+  writeReg(tms9918, TMS_REG_FG_BG_COLOR, backdrop);
+
+  vrEmuTms9918SetTiming(tms9918, TMS_TIMING_NTSC);
+
+  return tms9918;
+}
+
+/* Function:  checkRows
+ * ----------------------------------------
+ * check each row of an indexed frame is a single color: top above
+ * splitLine and bottom from it
+ */
+static void checkRows(const uint8_t* pixels, uint8_t splitLine, uint8_t top, uint8_t bottom)
+{
+  for (int y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    const uint8_t color = (y < splitLine) ? top : bottom;
+    int wrong = 0;
+    for (int x = 0; x < TMS9918_PIXELS_X; ++x)
+    {
+      wrong += pixels[y * TMS9918_PIXELS_X + x] != color;
+    }
+    if (wrong)
+    {
+      printf("  line %d: expected color %d\n", y, color);
+      CHECK(wrong == 0);
+      return;
+    }
+  }
+}
+
+/* renderers under test */
+typedef enum
+{
+  RENDER_FORMAT,
+  RENDER_UPDATE,
+  RENDER_BATCH,
+  RENDER_RANGES,
+  RENDER_POOL,
+} Renderer;
+
+static const char* rendererNames[] = { "RenderFrameFormat", "RenderFrameUpdate", "RenderFrameBatch",
+                                       "RenderFrameRanges", "PoolRenderFrame" };
+
+static VrEmuTms9918Pool* pool = NULL;
+
+/* Function:  renderRangesBackwards
+ * ----------------------------------------
+ * vrEmuTms9918ParallelFn rendering the last range first
+ */
+static void renderRangesBackwards(void* context, unsigned numRanges, vrEmuTms9918RangeFn render, void* frame)
+{
+  (void)context;
+
+  for (unsigned range = numRanges; range-- > 0;)
+  {
+    render(frame, range);
+  }
+}
+
+static void render(VrEmuTms9918* tms9918, Renderer renderer, uint8_t* pixels)
+{
+  switch (renderer)
+  {
+    case RENDER_FORMAT:
+      vrEmuTms9918RenderFrameFormat(tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+      break;
+
+    case RENDER_UPDATE:
+      vrEmuTms9918RenderFrameUpdate(tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+      break;
+
+    case RENDER_BATCH:
+    {
+      void* framePixels = pixels;
+      vrEmuTms9918RenderFrameBatch(&tms9918, 1, &framePixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+      break;
+    }
+
+    case RENDER_RANGES:
+      vrEmuTms9918RenderFrameRanges(tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX, 7, renderRangesBackwards, NULL);
+      break;
+
+    case RENDER_POOL:
+      vrEmuTms9918PoolRenderFrame(pool, tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+      break;
+  }
+}
+
+/* Function:  testChangeLog
+ * ----------------------------------------
+ * changes made part way through a frame show from their line, and
+ * changes made after the last active line don't show in the frame
+ */
+static void testChangeLog(Renderer renderer, bool midFrameChange)
+{
+  static uint8_t pixels[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+
+  printf("%s, %s mid-frame change\n", rendererNames[renderer], midFrameChange ? "with" : "without");
+
+  VrEmuTms9918* tms9918 = newGraphicsI(TMS_DK_BLUE);
+  CHECK(tms9918 != NULL);
+  if (tms9918 == NULL)
+    return;
+
+  /* the previous frame, for RenderFrameUpdate */
+  render(tms9918, renderer, pixels);
+  checkRows(pixels, 0, TMS_DK_BLUE, TMS_DK_BLUE);
+
+  if (midFrameChange)
+  {
+    clockToLine(tms9918, 100);
+    writeReg(tms9918, TMS_REG_FG_BG_COLOR, TMS_LT_BLUE);
+  }
+
+  clockToLine(tms9918, 200);
+  writeReg(tms9918, TMS_REG_FG_BG_COLOR, TMS_DK_RED);
+
+  render(tms9918, renderer, pixels);
+  checkRows(pixels, 100, TMS_DK_BLUE, midFrameChange ? TMS_LT_BLUE : TMS_DK_BLUE);
+  CHECK(vrEmuTms9918RegValue(tms9918, TMS_REG_FG_BG_COLOR) == TMS_DK_RED);
+
+  /* the vblank change shows in the next frame */
+  clockToLine(tms9918, TMS9918_LINES_NTSC);
+  render(tms9918, renderer, pixels);
+  checkRows(pixels, 0, TMS_DK_RED, TMS_DK_RED);
+
+  vrEmuTms9918Destroy(tms9918);
+}
+
+/* Function:  testSpritePatternUpdate
+ * ----------------------------------------
+ * vrEmuTms9918RenderFrameUpdate redraws a 16x16 sprite when the right
+ * half of sprite 255 changes. it is read past the 2KB sprite pattern
+ * table, and past the end of vram (wrapping) when the table is at 0x3800
+ */
+static void testSpritePatternUpdate(uint8_t spritePattTable)
+{
+  static uint8_t pixels[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+  static uint8_t expected[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+
+  printf("RenderFrameUpdate, sprite pattern table at 0x%04x\n", spritePattTable << 11);
+
+  VrEmuTms9918* tms9918 = newGraphicsI(TMS_BLACK);
+  CHECK(tms9918 != NULL);
+  if (tms9918 == NULL)
+    return;
+
+  vrEmuTms9918SetTiming(tms9918, TMS_TIMING_HOST);
+  writeReg(tms9918, TMS_REG_1, TMS_R1_RAM_16K | TMS_R1_DISP_ACTIVE | TMS_R1_SPRITE_16);
+  writeReg(tms9918, TMS_REG_SPRITE_PATT_TABLE, spritePattTable);
+
+  const uint8_t sprite[] = { 50, 100, 255, TMS_WHITE, 0xd0 };
+  writeVram(tms9918, 0x1800, sprite, sizeof(sprite));
+
+  vrEmuTms9918RenderFrameUpdate(tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+  CHECK(pixels[51 * TMS9918_PIXELS_X + 108] == TMS_BLACK);
+
+  /* first row of the right half */
+  const uint8_t row = 0xff;
+  writeVram(tms9918, (uint16_t)((spritePattTable << 11) + 255 * 8 + 16), &row, 1);
+
+  vrEmuTms9918RenderFrameUpdate(tms9918, pixels, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+  vrEmuTms9918RenderFrame(tms9918, expected, TMS9918_PIXELS_X);
+  CHECK(expected[51 * TMS9918_PIXELS_X + 108] == TMS_WHITE);
+  CHECK(memcmp(pixels, expected, sizeof(pixels)) == 0);
+
+  vrEmuTms9918Destroy(tms9918);
+}
+
+/* Function:  testWriteBlock
+ * ----------------------------------------
+ * vrEmuTms9918WriteBlock matches a vrEmuTms9918WriteData per byte,
+ * including blocks written part way through a clocked frame
+ */
+static void testWriteBlock(void)
+{
+  static uint8_t block[0x3000];
+  static uint8_t pixels[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+  static uint8_t expected[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+
+  printf("WriteBlock\n");
+
+  VrEmuTms9918* bytes = newGraphicsI(TMS_BLACK);
+  VrEmuTms9918* blocks = newGraphicsI(TMS_BLACK);
+  CHECK(bytes != NULL && blocks != NULL);
+  if (bytes == NULL || blocks == NULL)
+    return;
+
+  vrEmuTms9918EnableTileCache(blocks, true);
+
+  for (int frame = 0; frame < 4; ++frame)
+  {
+    /* names, patterns and colors, then sprites (vblank), on lines 0, 64 and 128 */
+    for (int write = 0; write < 4; ++write)
+    {
+      const uint16_t addr = (write == 3) ? 0x1800 : 0x0400 + (uint16_t)(write * 0x180);
+      const size_t numBytes = (write == 3) ? 128 : 0x1400 - (size_t)write * 0x180;
+
+      for (size_t i = 0; i < numBytes; ++i)
+      {
+        block[i] = (uint8_t)(i * 7 + frame * 13 + (i >> 5));
+      }
+      if (write == 3)
+      {
+        block[0] = 40;
+        block[4] = 0xd0;
+      }
+
+      clockToLine(bytes, (write == 3) ? 200 : (uint16_t)(write * 64));
+      clockToLine(blocks, (write == 3) ? 200 : (uint16_t)(write * 64));
+
+      writeVram(blocks, addr, block, numBytes);
+      vrEmuTms9918WriteAddr(bytes, (uint8_t)addr);
+      vrEmuTms9918WriteAddr(bytes, 0x40 | (uint8_t)(addr >> 8));
+      for (size_t i = 0; i < numBytes; ++i)
+      {
+        vrEmuTms9918WriteData(bytes, block[i]);
+      }
+    }
+
+    vrEmuTms9918RenderFrame(bytes, expected, TMS9918_PIXELS_X);
+    vrEmuTms9918RenderFrame(blocks, pixels, TMS9918_PIXELS_X);
+    CHECK(memcmp(pixels, expected, sizeof(pixels)) == 0);
+
+    clockToLine(bytes, TMS9918_LINES_NTSC);
+    clockToLine(blocks, TMS9918_LINES_NTSC);
+  }
+
+  vrEmuTms9918Destroy(bytes);
+  vrEmuTms9918Destroy(blocks);
+}
+
+/* Function:  testFrameRangesStatus
+ * ----------------------------------------
+ * a frame rendered in ranges leaves the same status as
+ * vrEmuTms9918RenderFrameFormat: sprite collisions and the fifth sprite,
+ * and with clocked timing, sprites moved after the last active line
+ * don't show in the frame
+ */
+static void testFrameRangesStatus(Renderer renderer, bool clocked)
+{
+  static uint8_t pixels[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+  static uint8_t expected[TMS9918_PIXELS_Y * TMS9918_PIXELS_X];
+
+  printf("%s status, %s timing\n", rendererNames[renderer], clocked ? "NTSC" : "host");
+
+  VrEmuTms9918* tms9918 = newGraphicsI(TMS_BLACK);
+  VrEmuTms9918* reference = newGraphicsI(TMS_BLACK);
+  CHECK(tms9918 != NULL && reference != NULL);
+  if (tms9918 == NULL || reference == NULL)
+    return;
+
+  /* six sprites on a row: the fifth sprite and a collision on lines 40 to 47.
+     with clocked timing, the first two move down during vblank */
+  const uint8_t pattern[8] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+  const uint8_t sprites[] = { 39, 10, 0, TMS_WHITE, 39, 14, 0, TMS_CYAN, 39, 40, 0, TMS_DK_RED,
+                              39, 60, 0, TMS_MED_GREEN, 39, 80, 0, TMS_MAGENTA, 39, 100, 0, TMS_GREY, 0xd0 };
+  const uint8_t moved[] = { 119, 10, 0, TMS_WHITE, 119, 14, 0, TMS_CYAN, 0xd0 };
+
+  for (int i = 0; i < 2; ++i)
+  {
+    VrEmuTms9918* tms = i ? reference : tms9918;
+
+    if (!clocked)
+    {
+      vrEmuTms9918SetTiming(tms, TMS_TIMING_HOST);
+    }
+    writeVram(tms, 0x2000, pattern, sizeof(pattern));
+    writeVram(tms, 0x1800, sprites, sizeof(sprites));
+    vrEmuTms9918ReadStatus(tms);
+
+    if (clocked)
+    {
+      clockToLine(tms, 200);
+      writeVram(tms, 0x1800, moved, sizeof(moved));
+    }
+  }
+
+  render(tms9918, renderer, pixels);
+  vrEmuTms9918RenderFrameFormat(reference, expected, TMS9918_PIXELS_X, TMS_PIXEL_FORMAT_INDEX);
+
+  CHECK(memcmp(pixels, expected, sizeof(pixels)) == 0);
+  CHECK(expected[40 * TMS9918_PIXELS_X + 60] == TMS_MED_GREEN);
+  CHECK(expected[40 * TMS9918_PIXELS_X + 80] == TMS_BLACK);
+  CHECK(expected[120 * TMS9918_PIXELS_X + 10] == TMS_BLACK);
+  CHECK(vrEmuTms9918StatusValue(tms9918) == vrEmuTms9918StatusValue(reference));
+  CHECK(vrEmuTms9918InterruptPending(tms9918) == vrEmuTms9918InterruptPending(reference));
+  if (!clocked)
+  {
+    CHECK((vrEmuTms9918StatusValue(tms9918) & 0xe0) == 0xe0);
+  }
+
+  /* the vblank change is still in place afterwards */
+  int vramDiffers = 0;
+  for (unsigned addr = 0; addr < 0x4000; ++addr)
+  {
+    vramDiffers += vrEmuTms9918VramValue(tms9918, (uint16_t)addr) != vrEmuTms9918VramValue(reference, (uint16_t)addr);
+  }
+  CHECK(vramDiffers == 0);
+  CHECK(vrEmuTms9918VramValue(tms9918, 0x1800) == (clocked ? 119 : 39));
+
+  vrEmuTms9918Destroy(tms9918);
+  vrEmuTms9918Destroy(reference);
+}
+
+/* random states
+ * ---------------------------------------- */
+
+#define STATUS_INT 0x80
+#define STATUS_5S  0x40
+#define STATUS_COL 0x20
+
+/* vram and registers, mirrored by every instance rendering the state */
+typedef struct
+{
+  uint8_t vram[0x4000];
+  uint8_t regs[8];
+} RandomState;
+
+static uint32_t rngState = 1;
+
+/* Function:  rnd
+ * ----------------------------------------
+ * xorshift32 (seeded through rngState)
+ */
+static uint32_t rnd(void)
+{
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+/* Function:  randomReg
+ * ----------------------------------------
+ * a random register value, biased towards displays worth checking
+ */
+static uint8_t randomReg(uint8_t reg)
+{
+  const uint8_t value = (uint8_t)rnd();
+
+  switch (reg)
+  {
+    case TMS_REG_0:
+      return value & 0x03;
+
+    case TMS_REG_1:
+      /* mostly enabled, any mode, sprite size and magnification */
+      return TMS_R1_RAM_16K | ((rnd() % 8) ? TMS_R1_DISP_ACTIVE : 0) | (value & 0x3b);
+
+    case TMS_REG_COLOR_TABLE:
+      /* mostly valid Graphics II tables */
+      return (rnd() % 4) ? (value | 0x7f) : value;
+
+    case TMS_REG_PATTERN_TABLE:
+      return (rnd() % 4) ? (value | 0x03) : value;
+
+    default:
+      return value;
+  }
+}
+
+/* Function:  randomSprite
+ * ----------------------------------------
+ * random sprite attributes. sprites bunch up in a band of lines, so the
+ * fifth sprite and collisions come up often
+ */
+static void randomSprite(uint8_t attr[4], uint8_t band)
+{
+  attr[0] = (uint8_t)(band + rnd() % 48 - 16);
+  if (attr[0] == 0xd0)
+  {
+    attr[0] = 0xd1;
+  }
+  attr[1] = (uint8_t)rnd();
+  attr[2] = (uint8_t)rnd();
+  attr[3] = (uint8_t)(rnd() & 0x8f);
+}
+
+/* Function:  randomState
+ * ----------------------------------------
+ * random vram and registers
+ */
+static void randomState(RandomState* state)
+{
+  for (unsigned i = 0; i < sizeof(state->vram); ++i)
+  {
+    state->vram[i] = (uint8_t)rnd();
+  }
+
+  for (uint8_t reg = 0; reg < 8; ++reg)
+  {
+    state->regs[reg] = randomReg(reg);
+  }
+
+  /* sprites, sometimes ended early */
+  const uint16_t spriteAttrTable = (state->regs[TMS_REG_SPRITE_ATTR_TABLE] & 0x7f) << 7;
+  const uint8_t band = (uint8_t)(rnd() % 200);
+  for (int i = 0; i < 32; ++i)
+  {
+    randomSprite(state->vram + spriteAttrTable + i * 4, band);
+  }
+  if (rnd() % 2)
+  {
+    state->vram[spriteAttrTable + (rnd() % 32) * 4] = 0xd0;
+  }
+}
+
+
+/* reference renderer
+ * ---------------------------------------- */
+
+/* Function:  refColor
+ * ----------------------------------------
+ * a pattern color, or the backdrop color if transparent
+ */
+static uint8_t refColor(const RandomState* state, uint8_t color)
+{
+  const bool enabled = state->regs[TMS_REG_1] & TMS_R1_DISP_ACTIVE;
+  const uint8_t backdrop = (enabled ? state->regs[TMS_REG_FG_BG_COLOR] : TMS_BLACK) & 0x0f;
+
+  return color ? color : backdrop;
+}
+
+/* Function:  refSprites
+ * ----------------------------------------
+ * draw the sprites of a line a pixel at a time and update the status
+ */
+static void refSprites(const RandomState* state, int y, uint8_t* pixels, uint8_t* status)
+{
+  const uint8_t* vram = state->vram;
+  const int size = (state->regs[TMS_REG_1] & TMS_R1_SPRITE_16) ? 16 : 8;
+  const int mag = (state->regs[TMS_REG_1] & TMS_R1_SPRITE_MAG2) ? 2 : 1;
+  const unsigned spriteAttrTable = (state->regs[TMS_REG_SPRITE_ATTR_TABLE] & 0x7f) << 7;
+  const unsigned spritePattTable = (state->regs[TMS_REG_SPRITE_PATT_TABLE] & 0x07) << 11;
+
+  bool covered[TMS9918_PIXELS_X] = { false };
+  int shown = 0;
+
+  for (int sprite = 0; sprite < 32; ++sprite)
+  {
+    const uint8_t* attr = vram + spriteAttrTable + sprite * 4;
+
+    if (attr[0] == 0xd0)
+    {
+      if (!(*status & STATUS_5S))
+      {
+        *status |= (uint8_t)sprite;
+      }
+      break;
+    }
+
+    /* rows start the line after the y position, and y > 0xe0 is above the screen */
+    const int top = ((attr[0] > 0xe0) ? attr[0] - 256 : attr[0]) + 1;
+
+    /* truncated: a magnified sprite's first row also shows the line above it */
+    const int row = (y - top) / mag;
+    if (row < 0 || row >= size)
+      continue;
+
+    if (++shown > 4)
+    {
+      if (!(*status & STATUS_5S))
+      {
+        *status |= STATUS_5S | (uint8_t)sprite;
+      }
+      break;
+    }
+
+    const int left = attr[1] - ((attr[3] & 0x80) ? 32 : 0);
+    const uint8_t color = attr[3] & 0x0f;
+
+    for (int px = 0; px < size * mag; ++px)
+    {
+      const int x = left + px;
+      const int bit = px / mag;
+      const uint8_t patt = vram[(spritePattTable + attr[2] * 8 + row + (bit / 8) * 16) & 0x3fff];
+
+      if (x < 0 || x >= TMS9918_PIXELS_X || !(patt & (0x80 >> (bit % 8))))
+        continue;
+
+      if (color)
+      {
+        pixels[x] = color;
+      }
+      if (covered[x])
+      {
+        *status |= STATUS_COL;
+      }
+      covered[x] = true;
+    }
+  }
+}
+
+/* Function:  refScanLine
+ * ----------------------------------------
+ * generate a line a pixel at a time, straight from the vram and registers
+ */
+static void refScanLine(const RandomState* state, int y, uint8_t* pixels, uint8_t* status)
+{
+  const uint8_t* vram = state->vram;
+  const uint8_t* regs = state->regs;
+
+  if (!(regs[TMS_REG_1] & TMS_R1_DISP_ACTIVE))
+  {
+    memset(pixels, refColor(state, 0), TMS9918_PIXELS_X);
+    return;
+  }
+
+  const bool graphicsII = regs[TMS_REG_0] & TMS_R0_MODE_GRAPHICS_II;
+  const uint8_t modeBits = regs[TMS_REG_1] & (TMS_R1_MODE_MULTICOLOR | TMS_R1_MODE_TEXT);
+  const unsigned nameTable = (regs[TMS_REG_NAME_TABLE] & 0x0f) << 10;
+  const unsigned colorTable = (regs[TMS_REG_COLOR_TABLE] & (graphicsII ? 0x80 : 0xff)) << 6;
+  const unsigned pattTable = (regs[TMS_REG_PATTERN_TABLE] & (graphicsII ? 0x04 : 0x07)) << 11;
+  const int row = y / 8;
+
+  if (!graphicsII && modeBits == TMS_R1_MODE_TEXT)
+  {
+    const uint8_t fg = refColor(state, regs[TMS_REG_FG_BG_COLOR] >> 4);
+    const uint8_t bg = refColor(state, 0);
+
+    for (int x = 0; x < TMS9918_PIXELS_X; ++x)
+    {
+      const int col = (x - 8) / 6;
+      const uint8_t patt = (x < 8 || x >= 248) ? 0 : vram[pattTable + vram[nameTable + row * 40 + col] * 8 + y % 8];
+      pixels[x] = (x >= 8 && (patt & (0x80 >> ((x - 8) % 6)))) ? fg : bg;
+    }
+    return;
+  }
+
+  for (int x = 0; x < TMS9918_PIXELS_X; ++x)
+  {
+    unsigned name = vram[nameTable + row * 32 + x / 8];
+    uint8_t patt, color;
+
+    if (graphicsII)
+    {
+      /* a third of the tables for each third of the screen, unless the
+         table addresses don't have their low bits set */
+      const bool valid = (regs[TMS_REG_PATTERN_TABLE] & 0x03) == 0x03 && (regs[TMS_REG_COLOR_TABLE] & 0x7f) == 0x7f;
+      const unsigned third = valid ? (unsigned)(row / 8) << 11 : 0;
+      name = valid ? name : (name & 0x07);
+      patt = vram[pattTable + third + name * 8 + y % 8];
+      color = vram[colorTable + third + name * 8 + y % 8];
+    }
+    else if (modeBits == TMS_R1_MODE_MULTICOLOR)
+    {
+      patt = 0xf0;
+      color = vram[pattTable + name * 8 + (row % 4) * 2 + (y / 4) % 2];
+    }
+    else
+    {
+      patt = vram[pattTable + name * 8 + y % 8];
+      color = vram[colorTable + name / 8];
+    }
+
+    pixels[x] = refColor(state, (patt & (0x80 >> (x % 8))) ? color >> 4 : color & 0x0f);
+  }
+
+  refSprites(state, y, pixels, status);
+}
+
+/* Function:  refFrame
+ * ----------------------------------------
+ * generate a frame of palette indexes and the status it leaves
+ */
+static uint8_t refFrame(const RandomState* state, uint8_t* pixels)
+{
+  uint8_t status = 0;
+
+  for (int y = 0; y < TMS9918_PIXELS_Y; ++y)
+  {
+    refScanLine(state, y, pixels + y * TMS9918_PIXELS_X, &status);
+  }
+
+  if (state->regs[TMS_REG_1] & TMS_R1_DISP_ACTIVE)
+  {
+    status |= STATUS_INT;
+  }
+
+  return status;
+}
+
+/* palette for the formatted output (distinct in every channel) */
+static const uint32_t testPalette[TMS9918_NUM_COLORS] = {
+  0x00000000, 0x10203040, 0x2131417f, 0x324252ff, 0x43536310, 0x54647421, 0x65758532, 0x76869643,
+  0x8797a754, 0x98a8b865, 0xa9b9c976, 0xbacadaf7, 0xcbdbeb08, 0xdcecfc19, 0xedfd0d2a, 0xfe0e1e3b,
+};
+
+/* Function:  refConvert
+ * ----------------------------------------
+ * convert palette indexes to a pixel format, as documented for each format
+ */
+static void refConvert(const uint8_t* indexes, uint8_t* out, vrEmuTms9918PixelFormat format)
+{
+  for (int i = 0; i < TMS9918_PIXELS_X * TMS9918_PIXELS_Y; ++i)
+  {
+    const uint32_t rgba = testPalette[indexes[i] & 0x0f];
+    const uint8_t r = (uint8_t)(rgba >> 24), g = (uint8_t)(rgba >> 16), b = (uint8_t)(rgba >> 8), a = (uint8_t)rgba;
+
+    switch (format)
+    {
+      case TMS_PIXEL_FORMAT_INDEX:
+        *out++ = indexes[i];
+        break;
+
+      case TMS_PIXEL_FORMAT_RGBA8888:
+        memcpy(out, &rgba, 4);
+        out += 4;
+        break;
+
+      case TMS_PIXEL_FORMAT_BGRA8888:
+      {
+        const uint32_t bgra = ((uint32_t)b << 24) | ((uint32_t)g << 16) | ((uint32_t)r << 8) | a;
+        memcpy(out, &bgra, 4);
+        out += 4;
+        break;
+      }
+
+      case TMS_PIXEL_FORMAT_RGB24:
+        *out++ = r;
+        *out++ = g;
+        *out++ = b;
+        break;
+
+      case TMS_PIXEL_FORMAT_RGB565:
+      {
+        const uint16_t rgb565 = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+        memcpy(out, &rgb565, 2);
+        out += 2;
+        break;
+      }
+
+      case TMS_PIXEL_FORMAT_RGBA32:
+        *out++ = r;
+        *out++ = g;
+        *out++ = b;
+        *out++ = a;
+        break;
+    }
+  }
+}
+
+
+/* random frames
+ * ---------------------------------------- */
+
+/* renderers checked against the reference */
+typedef enum
+{
+  RANDOM_SCANLINE,
+  RANDOM_FORMAT,
+  RANDOM_UPDATE,
+  RANDOM_BATCH,
+  RANDOM_LINES,
+  RANDOM_RANGES,
+  RANDOM_POOL,
+  NUM_RANDOM_RENDERERS
+} RandomRenderer;
+
+static const char* randomRendererNames[] = { "ScanLineFormat", "RenderFrameFormat", "RenderFrameUpdate",
+                                             "RenderFrameBatch", "RenderLines", "RenderFrameRanges", "PoolRenderFrame" };
+
+/* a full batch and one more, so a partial batch is rendered too */
+#define RANDOM_STATES (TMS9918_BATCH_LANES + 1)
+#define FRAME_BYTES (TMS9918_PIXELS_X * TMS9918_PIXELS_Y * 4)
+
+/* Function:  renderRandom
+ * ----------------------------------------
+ * render a frame of each instance, leaving the status of the frame
+ */
+static void renderRandom(RandomRenderer renderer, VrEmuTms9918** instances, uint8_t (*frames)[FRAME_BYTES], vrEmuTms9918PixelFormat format)
+{
+  const size_t pitch = TMS9918_PIXELS_X * (size_t)vrEmuTms9918PixelFormatBytes(format);
+
+  if (renderer == RANDOM_BATCH)
+  {
+    void* pixels[RANDOM_STATES];
+    for (int i = 0; i < RANDOM_STATES; ++i)
+    {
+      pixels[i] = frames[i];
+    }
+    vrEmuTms9918RenderFrameBatch(instances, RANDOM_STATES, pixels, pitch, format);
+    return;
+  }
+
+  for (int i = 0; i < RANDOM_STATES; ++i)
+  {
+    switch (renderer)
+    {
+      case RANDOM_SCANLINE:
+        for (int y = 0; y < TMS9918_PIXELS_Y; ++y)
+        {
+          vrEmuTms9918ScanLineFormat(instances[i], (uint8_t)y, frames[i] + y * pitch, format);
+        }
+        break;
+
+      case RANDOM_FORMAT:
+        vrEmuTms9918RenderFrameFormat(instances[i], frames[i], pitch, format);
+        break;
+
+      case RANDOM_UPDATE:
+        vrEmuTms9918RenderFrameUpdate(instances[i], frames[i], pitch, format);
+        break;
+
+      case RANDOM_LINES:
+        /* uneven ranges, out of order */
+        vrEmuTms9918RenderLines(instances[i], 101, 91, frames[i], pitch, format);
+        vrEmuTms9918RenderLines(instances[i], 0, 37, frames[i], pitch, format);
+        vrEmuTms9918RenderLines(instances[i], 37, 64, frames[i], pitch, format);
+        vrEmuTms9918FrameStatus(instances[i]);
+        break;
+
+      case RANDOM_RANGES:
+        vrEmuTms9918RenderFrameRanges(instances[i], frames[i], pitch, format, 5, renderRangesBackwards, NULL);
+        break;
+
+      case RANDOM_POOL:
+        vrEmuTms9918PoolRenderFrame(pool, instances[i], frames[i], pitch, format);
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+/* Function:  changeRandom
+ * ----------------------------------------
+ * make random changes to a state and every instance rendering it: vram
+ * blocks and bytes, sprites and now and then a register
+ */
+static void changeRandom(RandomState* state, VrEmuTms9918** instances, int numInstances)
+{
+  uint8_t block[64];
+  const int numChanges = 1 + (int)(rnd() % 8);
+
+  for (int change = 0; change < numChanges; ++change)
+  {
+    uint16_t addr = (uint16_t)(rnd() & 0x3fff);
+    size_t numBytes = 1 + rnd() % sizeof(block);
+
+    for (size_t i = 0; i < numBytes; ++i)
+    {
+      block[i] = (uint8_t)rnd();
+    }
+
+    switch (rnd() % 5)
+    {
+      case 0:
+        /* sprite attributes */
+        addr = (uint16_t)(((state->regs[TMS_REG_SPRITE_ATTR_TABLE] & 0x7f) << 7) + (rnd() % 32) * 4);
+        randomSprite(block, (uint8_t)(rnd() % 200));
+        numBytes = 4;
+        break;
+
+      case 1:
+      {
+        /* patterns of a sprite in the table, either half of a 16x16 sprite */
+        const uint8_t name = state->vram[(((state->regs[TMS_REG_SPRITE_ATTR_TABLE] & 0x7f) << 7) + (rnd() % 32) * 4 + 2) & 0x3fff];
+        addr = (uint16_t)((((state->regs[TMS_REG_SPRITE_PATT_TABLE] & 0x07) << 11) + name * 8 + rnd() % 32) & 0x3fff);
+        numBytes = 1 + rnd() % 8;
+        break;
+      }
+
+      case 2:
+        /* colors, in a Graphics I color table if that's the mode */
+        addr = (uint16_t)(((state->regs[TMS_REG_COLOR_TABLE] & 0x80) << 6) + (rnd() & 0x1fff));
+        if (!(state->regs[TMS_REG_0] & TMS_R0_MODE_GRAPHICS_II))
+        {
+          addr = (uint16_t)((state->regs[TMS_REG_COLOR_TABLE] << 6) + rnd() % 32);
+          numBytes = 1 + rnd() % 4;
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    for (size_t i = 0; i < numBytes; ++i)
+    {
+      state->vram[(addr + i) & 0x3fff] = block[i];
+    }
+
+    /* through vrEmuTms9918WriteBlock or a byte at a time */
+    const bool perByte = rnd() % 2;
+    for (int i = 0; i < numInstances; ++i)
+    {
+      if (perByte)
+      {
+        vrEmuTms9918WriteAddr(instances[i], (uint8_t)addr);
+        vrEmuTms9918WriteAddr(instances[i], 0x40 | ((addr >> 8) & 0x3f));
+        for (size_t j = 0; j < numBytes; ++j)
+        {
+          vrEmuTms9918WriteData(instances[i], block[j]);
+        }
+      }
+      else
+      {
+        writeVram(instances[i], addr, block, numBytes);
+      }
+    }
+  }
+
+  if (rnd() % 3 == 0)
+  {
+    const uint8_t reg = (uint8_t)(rnd() % 8);
+    state->regs[reg] = randomReg(reg);
+
+    for (int i = 0; i < numInstances; ++i)
+    {
+      writeReg(instances[i], reg, state->regs[reg]);
+    }
+  }
+}
+
+/* Function:  testRandomFrames
+ * ----------------------------------------
+ * every renderer matches a pixel at a time reference, pixels and status,
+ * over random vram and registers changed between frames. covers each
+ * pixel format, the tile cache on and off, the sprite cache (and
+ * RenderLines without it) and lazy and eager collisions
+ */
+static void testRandomFrames(uint32_t seed, int numIterations)
+{
+  static RandomState states[RANDOM_STATES];
+  static uint8_t indexes[RANDOM_STATES][TMS9918_PIXELS_X * TMS9918_PIXELS_Y];
+  static uint8_t expected[RANDOM_STATES][FRAME_BYTES];
+  static uint8_t frames[RANDOM_STATES][FRAME_BYTES];
+  static uint8_t updateFrames[RANDOM_STATES][FRAME_BYTES];   /* kept between frames */
+  uint8_t expectedStatus[RANDOM_STATES];
+
+  printf("random frames, seed 0x%08x\n", (unsigned)seed);
+  rngState = seed;
+
+  for (int iteration = 0; iteration < numIterations; ++iteration)
+  {
+    const vrEmuTms9918PixelFormat format = (vrEmuTms9918PixelFormat)(iteration % 6);
+    const bool tileCache = (iteration / 6) % 2;
+    const bool lazyCollisions = (iteration / 12) % 2;
+    const size_t frameBytes = (size_t)TMS9918_PIXELS_X * TMS9918_PIXELS_Y * vrEmuTms9918PixelFormatBytes(format);
+
+    VrEmuTms9918* instances[NUM_RANDOM_RENDERERS][RANDOM_STATES] = { { NULL } };
+    VrEmuTms9918* all[NUM_RANDOM_RENDERERS * RANDOM_STATES];
+    int numInstances = 0;
+
+    for (int i = 0; i < RANDOM_STATES; ++i)
+    {
+      randomState(&states[i]);
+    }
+
+    for (int renderer = 0; renderer < NUM_RANDOM_RENDERERS; ++renderer)
+    {
+      for (int i = 0; i < RANDOM_STATES; ++i)
+      {
+        VrEmuTms9918* tms9918 = vrEmuTms9918New();
+        CHECK(tms9918 != NULL);
+        if (tms9918 == NULL)
+          continue;
+
+        instances[renderer][i] = all[numInstances++] = tms9918;
+        vrEmuTms9918SetPalette(tms9918, testPalette);
+        vrEmuTms9918EnableLazyCollisions(tms9918, lazyCollisions);
+        CHECK(vrEmuTms9918EnableTileCache(tms9918, tileCache));
+
+        writeVram(tms9918, 0, states[i].vram, sizeof(states[i].vram));
+        for (uint8_t reg = 0; reg < 8; ++reg)
+        {
+          writeReg(tms9918, reg, states[i].regs[reg]);
+        }
+      }
+    }
+
+    if (numInstances < NUM_RANDOM_RENDERERS * RANDOM_STATES)
+    {
+      while (numInstances)
+      {
+        vrEmuTms9918Destroy(all[--numInstances]);
+      }
+      return;
+    }
+
+    /* consecutive frames of each instance, so the caches and
+       RenderFrameUpdate work from the frame before */
+    for (int frame = 0; frame < 3; ++frame)
+    {
+      for (int i = 0; i < RANDOM_STATES; ++i)
+      {
+        expectedStatus[i] = refFrame(&states[i], indexes[i]);
+        refConvert(indexes[i], expected[i], format);
+      }
+
+      for (int renderer = 0; renderer < NUM_RANDOM_RENDERERS; ++renderer)
+      {
+        if (renderer == RANDOM_POOL && pool == NULL)
+          continue;
+
+        uint8_t (*pixels)[FRAME_BYTES] = (renderer == RANDOM_UPDATE) ? updateFrames : frames;
+        renderRandom((RandomRenderer)renderer, instances[renderer], pixels, format);
+
+        for (int i = 0; i < RANDOM_STATES; ++i)
+        {
+          const uint8_t status = vrEmuTms9918ReadStatus(instances[renderer][i]);
+
+          if (memcmp(pixels[i], expected[i], frameBytes) != 0 || status != expectedStatus[i])
+          {
+            printf("  %s: iteration %d frame %d state %d (format %d, r0 %02x r1 %02x): status %02x, expected %02x\n",
+                   randomRendererNames[renderer], iteration, frame, i, (int)format,
+                   states[i].regs[TMS_REG_0], states[i].regs[TMS_REG_1], status, expectedStatus[i]);
+            CHECK(memcmp(pixels[i], expected[i], frameBytes) == 0);
+            CHECK(status == expectedStatus[i]);
+          }
+        }
+      }
+
+      for (int i = 0; i < RANDOM_STATES; ++i)
+      {
+        VrEmuTms9918* stateInstances[NUM_RANDOM_RENDERERS];
+        for (int renderer = 0; renderer < NUM_RANDOM_RENDERERS; ++renderer)
+        {
+          stateInstances[renderer] = instances[renderer][i];
+        }
+        changeRandom(&states[i], stateInstances, NUM_RANDOM_RENDERERS);
+      }
+    }
+
+    for (int i = 0; i < numInstances; ++i)
+    {
+      vrEmuTms9918Destroy(all[i]);
+    }
+  }
+}
+
+int main()
+{
+  pool = vrEmuTms9918PoolNew(4);
+  CHECK(pool != NULL);
+
+  for (int renderer = RENDER_FORMAT; renderer <= RENDER_POOL; ++renderer)
+  {
+    if (renderer == RENDER_POOL && pool == NULL)
+      continue;
+
+    testChangeLog((Renderer)renderer, true);
+    testChangeLog((Renderer)renderer, false);
+  }
+
+  testFrameRangesStatus(RENDER_RANGES, false);
+  testFrameRangesStatus(RENDER_RANGES, true);
+  if (pool != NULL)
+  {
+    testFrameRangesStatus(RENDER_POOL, false);
+    testFrameRangesStatus(RENDER_POOL, true);
+  }
+
+  testSpritePatternUpdate(0x04);
+  testSpritePatternUpdate(0x07);
+  testWriteBlock();
+  testRandomFrames(0x9918, 24);
+  testRandomFrames(0x2468ace1, 24);
+
+  vrEmuTms9918PoolDestroy(pool);
+
+  printf(failures ? "%d check(s) failed\n" : "all tests passed\n", failures);
+  return failures ? 1 : 0;
+}